@@ -2,10 +2,26 @@
  * Created by Ivo Georgiev on 2/9/16.
  */
 
+#define _GNU_SOURCE // mmap flags and madvise advice beyond POSIX
+
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h> // for perror()
+#include <stdint.h>
 #include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // the fit scans, compiled per function for AVX2 and SSE4.2
+#endif
 #include "mem_pool.h"
 
 /*************/
@@ -21,13 +37,64 @@ static const float      MEM_POOL_STORE_FILL_FACTOR      = 0.75;
 static const unsigned   MEM_POOL_STORE_EXPAND_FACTOR    = 2;
 
 static const unsigned   MEM_NODE_HEAP_INIT_CAPACITY     = 40;
-static const float      MEM_NODE_HEAP_FILL_FACTOR       = 0.75;
-static const unsigned   MEM_NODE_HEAP_EXPAND_FACTOR     = 2;
+static const unsigned   MEM_NODE_CHUNK_SHIFT            = 8;
+static const unsigned   MEM_NODE_CHUNK_NODES            = 256;  // 1 << MEM_NODE_CHUNK_SHIFT
+static const size_t     MEM_NODE_CHUNK_SIZE             = 8192; // 32 bytes per node, also the alignment
+static const unsigned   MEM_NODE_DIR_INIT_CAPACITY      = 8;
+static const unsigned   MEM_NODE_DIR_EXPAND_FACTOR      = 2;
 
 static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 
+static const size_t     MEM_RELEASE_THRESHOLD           = 64 * 1024; // gaps this large give pages back
+
+static const size_t     MEM_QUICK_BIN_MIN               = sizeof(uint32_t); // room for the bin link
+static const size_t     MEM_QUICK_BIN_MAX               = 256;
+static const size_t     MEM_QUICK_BIN_LIMIT             = 256 * 1024; // binned bytes before coalescing
+static const unsigned   MEM_AUTO_WINDOW                 = 1024; // AUTO_FIT: allocations between choices
+static const float      MEM_AUTO_FRAG_HIGH              = 0.5;  // more fragmented, and it turns BEST_FIT
+static const float      MEM_AUTO_FRAG_LOW               = 0.2;  // less, and back to FIRST_FIT
+static const unsigned   MEM_AUTO_LONG_SCAN              = 4;    // first-fit scans past 1/4 of the nodes are long
+static const unsigned   MEM_AUTO_MIN_NODES              = 256;  // with fewer nodes, no scan is
+static const size_t     MEM_SMALL_MAX                   = 64;   // largest request served from a slab slot
+static const size_t     MEM_SMALL_GRANULE               = 8;    // size classes are multiples of this
+static const size_t     MEM_SMALL_SLAB_SIZE             = 2048; // slab header and records, also the alignment
+static const unsigned   MEM_SMALL_SLAB_SLOTS            = 120;  // as many as fit, at most 128 for the bitmap
+static const unsigned   MEM_SMALL_DIR_INIT_CAPACITY     = 8;
+static const unsigned   MEM_SMALL_DIR_EXPAND_FACTOR     = 2;
+static const unsigned   MEM_MAP_PAGE_SHIFT              = 12; // pool ranges are whole pages of at least 4 KB
+static const unsigned   MEM_MAP_LEVELS                  = 4;
+static const unsigned   MEM_MAP_BITS                    = 9;  // per level, a 4 KB node; 48-bit addresses
+static const unsigned   MEM_SUB_POOLS_INIT_CAPACITY     = 8;
+static const unsigned   MEM_SUB_POOLS_EXPAND_FACTOR     = 2;
+static const unsigned   MEM_ROUTE_TABLE_INIT_CAPACITY   = 4;
+static const unsigned   MEM_ROUTE_TABLE_EXPAND_FACTOR   = 2;
+static const unsigned   MEM_LARGE_TABLE_INIT_CAPACITY   = 8;
+static const unsigned   MEM_LARGE_TABLE_EXPAND_FACTOR   = 2;
+static const size_t     MEM_HUGE_PAGE_SIZE              = 2 * 1024 * 1024;
+
+static const unsigned   MEM_SCAVENGER_INTERVAL_MS       = 1000;
+static const unsigned   MEM_SCAVENGER_IDLE_MS           = 5000;
+static const size_t     MEM_SCAVENGER_MAX_BYTES_PER_PASS = 64 * 1024 * 1024;
+
+static const char       MEM_NUMA_ONLINE_PATH[]          = "/sys/devices/system/node/online";
+static const int        MEM_MPOL_BIND                   = 2; // <numaif.h> isn't part of libc
+static const int        MEM_MPOL_INTERLEAVE             = 3;
+static const int        MEM_MADV_POPULATE_WRITE         = 23; // Linux 5.14, not in older <sys/mman.h>
+
+static const char       MEM_FILE_MAGIC[8]               = "MEMPOOL";
+static const uint32_t   MEM_FILE_VERSION                = 1;
+static const uint32_t   MEM_FILE_NO_NODE                = 0xFFFFFFFF;
+static const uint32_t   MEM_NO_NODE                     = 0xFFFFFFFF; // end of the node list
+static const uint64_t   MEM_NODE_SIZE_MASK              = 0xFFFFFFFFFFFFull; // 48-bit sizes
+static const unsigned   MEM_NODE_FLAGS_SHIFT            = 56;
+
+static const size_t     MEM_CACHE_SLAB_SIZE             = 8192;
+static const unsigned   MEM_CACHE_SLAB_MIN_OBJS         = 8;
+static const unsigned   MEM_CACHE_SLAB_STORE_INIT_CAPACITY = 8;
+static const unsigned   MEM_CACHE_SLAB_STORE_EXPAND_FACTOR = 2;
+
 
 
 /*********************/
@@ -35,27 +102,186 @@ static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 /* Type declarations */
 /*                   */
 /*********************/
-typedef struct _node {
-    alloc_t alloc_record;
-    unsigned used;
-    unsigned allocated;
-    struct _node *next, *prev; // doubly-linked list for gap deletion
-} node_t, *node_pt;
+typedef enum _node_flags {
+    NODE_USED       = 0x1,
+    NODE_ALLOCATED  = 0x2,  // a gap is a node with NODE_USED alone
+    NODE_MOVABLE    = 0x4,  // allocated by mem_new_handle, mem_pool_compact may move it
+    NODE_BINNED     = 0x8   // freed into a quick bin, neither allocated nor a gap yet
+} node_flags;
+
+// the node heap is kept as parallel columns, so that the fit scans
+// pull only sizes, flags and links through the cache; apart from the
+// records, a node is 16 bytes and holds no pointers. With its record,
+// which is the user's handle and can't be folded in, it is 32, and a
+// gap adds its 12-byte entry in the gap index
+//
+// the columns are cut into fixed-size chunks that never move once
+// allocated: growing the heap adds a chunk and copies nothing, so the
+// records handed out to the user stay valid. A chunk is laid out as
+//   [records][meta][next][prev][index in the chunk directory][live nodes]
+// and aligned to MEM_NODE_CHUNK_SIZE, so masking the address of a
+// record finds its chunk. Unlinked slots are kept on a free list, also
+// threaded through next/prev, and trailing chunks with no live nodes
+// are given back.
+//   records   allocation records, handed out to the user
+//   meta      size in the low 48 bits, node_flags in the top byte
+//   next/prev doubly-linked list in address order, node indices
+typedef struct _node_heap {
+    char **chunks;          // node i is slot i % MEM_NODE_CHUNK_NODES of chunks[i >> MEM_NODE_CHUNK_SHIFT]
+    unsigned num_chunks;
+    unsigned chunks_capacity;
+} node_heap_t, *node_heap_pt;
 
+// 12 bytes; the size is read from the node
 typedef struct _gap {
-    size_t size;
-    node_pt node;
+    uint32_t node;
+    uint32_t epoch;         // scavenger epoch in which the gap was last freed into
+    uint32_t released;      // leading pages the scavenger has already given back
 } gap_t, *gap_pt;
 
+// POOL_SMALL_OBJECTS: requests up to MEM_SMALL_MAX take a slot in a slab of
+// their size class instead of a node. The slots are one pool allocation;
+// the header, bitmap and records live on the side, aligned to
+// MEM_SMALL_SLAB_SIZE, so masking the address of a record finds its slab.
+typedef struct _small_slab {
+    unsigned index;         // position in the pool's slab directory
+    unsigned node;          // the pool allocation the slots are carved from
+    unsigned num_free;
+    unsigned slot_size;
+    char *mem;
+    uint64_t free_map[2];   // set bits are free slots
+    struct _small_slab *next_partial; // next slab of the class with a free slot
+    alloc_t records[];      // MEM_SMALL_SLAB_SLOTS, handed out to the user
+} small_slab_t, *small_slab_pt;
+
+// above the pool's large_threshold, an allocation is a mapping of its
+// own, outside the pool, unmapped as soon as it is freed
+typedef struct _large_alloc {
+    alloc_t record;         // handed out to the user
+    size_t mapped_size;     // whole pages
+} large_alloc_t, *large_alloc_pt;
+
+// the fit scans test a run of meta words for gaps of at least the size
+// asked for; bit i of mask is set if meta[i] is one
+typedef void (*fit_scan_fn)(const uint64_t *meta, unsigned count, uint64_t want, uint64_t span, uint64_t *mask);
+
+typedef struct _numa_mask {
+    unsigned long bits[1024 / (8 * sizeof(unsigned long))];
+} numa_mask_t;
+
+typedef enum _pool_backing { BACKING_ANON, BACKING_FILE, BACKING_PARENT } pool_backing;
+
+// AUTO_FIT: the fit in use, and what the pool has seen over the current
+// window of allocations. A free of one of the last few allocations is a
+// short lifetime; first-fit scans count the nodes they visit
+typedef struct _auto_fit {
+    alloc_policy fit;       // FIRST_FIT or BEST_FIT, until the window ends
+    int bins;               // the quick bins are its doing, so it may drop them
+    unsigned long_scan_nodes; // nodes in the list when long scans made it BEST_FIT, else 0
+    unsigned allocs;
+    unsigned small;         // allocations of up to MEM_QUICK_BIN_MAX bytes
+    unsigned frees;
+    unsigned short_lived;   // frees of one of the recent allocations
+    unsigned scans;
+    unsigned long steps;
+    char *recent[16];       // the last allocations, a ring
+    unsigned next_recent;
+} auto_fit_t;
+
 typedef struct _pool_mgr {
     pool_t pool;
-    node_pt node_heap;
+    node_heap_t node_heap;
     unsigned total_nodes;
-    unsigned used_nodes;
+    unsigned used_nodes;    // slots ever handed out, the sweeps stop here
+    unsigned free_nodes;    // unlinked slots below used_nodes, linked through their next/prev columns
+    unsigned head;          // first node in address order, only compaction changes it
     gap_pt gap_ix;
     unsigned gap_ix_capacity;
+    unsigned gap_histogram[MEM_STATS_BUCKETS]; // gaps by log2 of their size, kept with the gap index
+    uint32_t *quick_bins;   // POOL_QUICK_BINS: freed nodes by exact size, LIFO, linked through the blocks
+    size_t binned_bytes;
+    auto_fit_t auto_fit;          // AUTO_FIT: the fit in use and the sample it is chosen from
+    small_slab_pt *small_partial; // POOL_SMALL_OBJECTS: per size class, slabs with a free slot
+    small_slab_pt *small_slabs;   // every slab, by small_slab_t.index
+    unsigned num_small_slabs;
+    unsigned small_slabs_capacity;
+    size_t large_threshold;       // requests above this are mapped apart, 0 for none
+    large_alloc_pt *large_allocs; // side table of those mappings
+    unsigned num_large_allocs;
+    unsigned large_allocs_capacity;
+    size_t large_bytes;           // part of alloc_size, but not of the pool
+    size_t mapped_size;     // pool memory is an anonymous mapping of whole pages
+    size_t reserved_size;   // address range reserved, mapped_size of it is committed
+    size_t page_size;       // granularity of the mapping, 2 MB if backed by huge pages
+    unsigned flags;         // pool_flags in effect, after any fallback
+    pool_backing backing;
+    int fd;                 // BACKING_FILE: the pool file
+    size_t data_offset;     // BACKING_FILE: where the pool memory starts in the file
+    struct _pool_mgr *parent;     // BACKING_PARENT: the pool the memory is an allocation of
+    alloc_pt parent_alloc;
+    struct _pool_mgr **subs;      // sub-pools carved from this one, by address, under pool_map_lock
+    unsigned num_subs;
+    unsigned subs_capacity;
+    unsigned store_index;   // slot in the pool store
+    pthread_mutex_t lock;   // taken by the scavenger while it walks the gap index
 } pool_mgr_t, *pool_mgr_pt;
 
+// on-disk format of a persistent pool:
+//   [header][pool memory, data_offset..][node table][gap table]
+// the tables hold offsets and node indices instead of pointers
+typedef struct _pool_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t policy;
+    uint64_t data_offset;
+    uint64_t total_size;
+    uint64_t alloc_size;
+    uint64_t meta_offset;
+    uint32_t num_allocs;
+    uint32_t num_gaps;
+    uint32_t used_nodes;
+    uint32_t head;              // first node in address order, 0 unless compacted
+} pool_file_header_t;
+
+typedef struct _pool_file_node {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t next, prev;        // node indices, MEM_FILE_NO_NODE for none
+    uint32_t used;
+    uint32_t allocated;         // 1, or 2 for a handle mem_pool_compact may move
+} pool_file_node_t;
+
+typedef struct _pool_file_gap {
+    uint64_t size;
+    uint64_t node;              // node index
+} pool_file_gap_t;
+
+typedef struct _slab {
+    alloc_pt alloc;             // the slab's allocation, mapped apart if above large_threshold
+    char *objs;                 // first aligned object in the slab
+    unsigned num_free;
+    unsigned *free_ix;          // LIFO stack of free (constructed) object indices
+    struct _slab *next_partial; // singly-linked list of slabs with free objects
+} slab_t, *slab_pt;
+
+typedef struct _cache_mgr {
+    cache_t cache;
+    cache_ctor ctor;
+    cache_dtor dtor;
+    size_t stride;
+    unsigned objs_per_slab;
+    slab_pt *slabs;             // sorted by address, for lookup on free
+    unsigned slabs_capacity;
+    slab_pt partial;
+} cache_mgr_t, *cache_mgr_pt;
+
+// mem_new_alloc_routed sends a request to the pool of the smallest
+// size class it fits in
+typedef struct _size_route {
+    size_t max_size;
+    pool_mgr_pt pool;
+} size_route_t, *size_route_pt;
+
 
 
 /***************************/
@@ -66,6 +292,28 @@ typedef struct _pool_mgr {
 static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
 static unsigned pool_store_size = 0;
 static unsigned pool_store_capacity = 0;
+static unsigned pool_store_hole = 0; // no slot below this one was freed by mem_pool_close
+static pthread_mutex_t pool_store_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_route_pt route_table = NULL; // by max_size, under pool_store_lock
+static unsigned route_table_size = 0;
+static unsigned route_table_capacity = 0;
+
+// mem_pool_of: a radix tree over page numbers, MEM_MAP_BITS per level, as
+// the page tables are. A slot holds a child node, or the owning pool_mgr_pt
+// tagged with the low bit when the pool covers every page below the slot
+static uintptr_t *pool_map = NULL;
+static pthread_rwlock_t pool_map_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// the scavenger thread releases idle gaps instead of mem_del_alloc
+static atomic_int scavenger_running = 0;
+static atomic_ulong scavenger_epoch = 0; // one tick per scavenger pass
+static fit_scan_fn fit_scan = NULL;      // widest the CPU has, picked by mem_init
+static pthread_t scavenger_thread;
+static pthread_mutex_t scavenger_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scavenger_wake;
+static int scavenger_stopping = 0;
+static scavenger_options_t scavenger_options;
+static scavenger_stats_t scavenger_stats;
 
 
 
@@ -75,21 +323,95 @@ static unsigned pool_store_capacity = 0;
 /*                                          */
 /********************************************/
 static alloc_status _mem_resize_pool_store();
+static alloc_status _mem_add_to_pool_store(pool_mgr_pt poolMgr);
+static void _mem_remove_routes(pool_mgr_pt poolMgr);
+static alloc_status _mem_map_range(const char *mem, size_t size, pool_mgr_pt owner);
+static alloc_status _mem_map_set(uintptr_t *node, unsigned level, uintptr_t base,
+                                 uintptr_t lo, uintptr_t hi, uintptr_t value);
+static void _mem_map_free(uintptr_t entry, unsigned level);
+static alloc_status _mem_map_sub(pool_mgr_pt poolMgr, int add);
 static alloc_status _mem_resize_node_heap(pool_mgr_pt poolMgr);
+static alloc_status _mem_reserve_node_heap(node_heap_pt heap, unsigned capacity);
+static void _mem_free_node_heap(node_heap_pt heap);
+static void _mem_shrink_node_heap(pool_mgr_pt poolMgr);
+static unsigned _mem_record_node(const node_heap_t *heap, const alloc_t *record);
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt poolMgr);
 static alloc_status
         _mem_add_to_gap_ix(pool_mgr_pt poolMgr,
                            size_t size,
-                           node_pt node);
+                           unsigned node);
 static alloc_status
         _mem_remove_from_gap_ix(pool_mgr_pt poolMgr,
                                 size_t size,
-                                node_pt node);
+                                unsigned node);
 static alloc_status _mem_sort_gap_ix(pool_mgr_pt poolMgr);
-static alloc_status _add_gap(pool_mgr_pt poolMgr, node_pt node);
-static node_pt _add_node(pool_mgr_pt poolMgr, node_pt prevNode);
-static node_pt _convert_gap(pool_mgr_pt poolMgr, gap_pt gap, size_t size);
-static void _sortGap(gap_pt gapIX, int lower, int higher);
+static alloc_status _add_gap(pool_mgr_pt poolMgr, unsigned node);
+static void _mem_count_gap(pool_mgr_pt poolMgr, size_t size, int delta);
+static void _mem_resize_gap(pool_mgr_pt poolMgr, unsigned node, size_t size);
+static unsigned _add_node(pool_mgr_pt poolMgr, unsigned prevNode);
+static unsigned _convert_gap(pool_mgr_pt poolMgr, gap_pt gap, size_t size);
+static void _sortGap(const node_heap_t *heap, gap_pt gapIX, int lower, int higher);
+static gap_pt _mem_find_gap(pool_mgr_pt poolMgr, unsigned node);
+static void _unlink_node(pool_mgr_pt poolMgr, unsigned node);
+static alloc_pt _chunk_records(char *chunk);
+static uint64_t *_chunk_meta(char *chunk);
+static uint32_t *_chunk_next(char *chunk);
+static uint32_t *_chunk_prev(char *chunk);
+static unsigned *_chunk_index(char *chunk);
+static unsigned *_chunk_live(char *chunk);
+static alloc_pt _node_record(const node_heap_t *heap, unsigned node);
+static unsigned _node_next(const node_heap_t *heap, unsigned node);
+static unsigned _node_prev(const node_heap_t *heap, unsigned node);
+static void _set_node_next(node_heap_pt heap, unsigned node, unsigned next);
+static void _set_node_prev(node_heap_pt heap, unsigned node, unsigned prev);
+static size_t _node_size(const node_heap_t *heap, unsigned node);
+static unsigned _node_flags(const node_heap_t *heap, unsigned node);
+static void _set_node_size(node_heap_pt heap, unsigned node, size_t size);
+static void _set_node_flags(node_heap_pt heap, unsigned node, unsigned flags);
+static unsigned _mem_last_node(pool_mgr_pt poolMgr);
+static size_t _mem_release_pages(pool_mgr_pt poolMgr, unsigned gap, char *lo, char *hi);
+static alloc_status _mem_trim(pool_mgr_pt poolMgr, size_t keep_bytes);
+static int _mem_quick_push(pool_mgr_pt poolMgr, unsigned node);
+static unsigned _mem_quick_pop(pool_mgr_pt poolMgr, size_t size);
+static void _mem_quick_flush(pool_mgr_pt poolMgr);
+static alloc_status _mem_quick_enable(pool_mgr_pt poolMgr);
+static void _mem_quick_disable(pool_mgr_pt poolMgr);
+static void _mem_auto_alloc(pool_mgr_pt poolMgr, size_t size, alloc_pt alloc);
+static void _mem_auto_free(pool_mgr_pt poolMgr, alloc_pt alloc);
+static void _mem_auto_adapt(pool_mgr_pt poolMgr);
+static size_t _mem_slide(pool_mgr_pt poolMgr, unsigned gap, unsigned node);
+static unsigned _mem_new_node(pool_mgr_pt poolMgr, size_t size);
+static alloc_pt _mem_small_alloc(pool_mgr_pt poolMgr, size_t size);
+static alloc_status _mem_small_free(pool_mgr_pt poolMgr, small_slab_pt slab, alloc_pt alloc);
+static small_slab_pt _mem_small_add_slab(pool_mgr_pt poolMgr, size_t slot_size);
+static void _mem_small_release_slab(pool_mgr_pt poolMgr, small_slab_pt slab);
+static small_slab_pt _mem_small_slab_of(pool_mgr_pt poolMgr, const alloc_t *alloc);
+static alloc_pt _mem_large_alloc(pool_mgr_pt poolMgr, size_t size);
+static unsigned _mem_large_find(pool_mgr_pt poolMgr, const alloc_t *alloc);
+static void *_mem_scavenger_main(void *arg);
+static void _mem_scavenge_pass();
+static unsigned _mem_find_node(pool_mgr_pt poolMgr, const char *mem);
+static alloc_status _mem_map_pool(pool_mgr_pt poolMgr, const pool_options_t *options);
+static unsigned _mem_numa_online(numa_mask_t *mask);
+static void _mem_numa_place(pool_mgr_pt poolMgr, const pool_options_t *options);
+static void _mem_prefault(char *mem, size_t size);
+static unsigned _mem_find_fit(pool_mgr_pt poolMgr, size_t size);
+static fit_scan_fn _mem_pick_fit_scan();
+static void _mem_fit_scan_scalar(const uint64_t *meta, unsigned count, uint64_t want, uint64_t span, uint64_t *mask);
+#if defined(__x86_64__) || defined(__i386__)
+static void _mem_fit_scan_sse42(const uint64_t *meta, unsigned count, uint64_t want, uint64_t span, uint64_t *mask);
+static void _mem_fit_scan_avx2(const uint64_t *meta, unsigned count, uint64_t want, uint64_t span, uint64_t *mask);
+#endif
+static alloc_status _mem_grow_pool(pool_mgr_pt poolMgr, size_t size);
+static alloc_status _mem_alloc_metadata(pool_mgr_pt poolMgr, unsigned nodes, unsigned gaps);
+static alloc_status _mem_init_head(pool_mgr_pt poolMgr);
+static alloc_status _mem_file_sync(pool_mgr_pt poolMgr);
+static alloc_status _mem_file_load(pool_mgr_pt poolMgr, const pool_file_header_t *header);
+static alloc_status _mem_file_check(const pool_file_header_t *header, const pool_file_node_t *nodes,
+                                    const pool_file_gap_t *gaps);
+static alloc_status _mem_cache_add_slab(cache_mgr_pt cacheMgr);
+static alloc_status _mem_cache_release_slab(cache_mgr_pt cacheMgr, slab_pt slab);
+static slab_pt _mem_cache_find_slab(cache_mgr_pt cacheMgr, const char *obj);
 static size_t align (size_t x) { return (((((x)-1)>>2)<<2)+4); }
 /****************************************/
 /*                                      */
@@ -111,6 +433,7 @@ alloc_status mem_init() {
 		else {
 			pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
 			pool_store_size = 0;
+			fit_scan = _mem_pick_fit_scan();
 			return ALLOC_OK;
 		}
 	} else {
@@ -129,13 +452,29 @@ alloc_status mem_free() {
 	if (!pool_store) {
 		return ALLOC_CALLED_AGAIN;
 	} else {
-		for (unsigned int i = 0; i < pool_store_size; i++) {
-			mem_pool_close((pool_pt)pool_store[i]);
+		mem_scavenger_stop();
+		// sub-pools have to go back before their parents, so keep going
+		// round for as long as some pool closes
+		int closed = 1;
+		while (closed) {
+			closed = 0;
+			for (unsigned int i = 0; i < pool_store_size; i++) {
+				if (pool_store[i] != NULL && mem_pool_close((pool_pt)pool_store[i]) == ALLOC_OK) closed = 1;
+			}
 		}
 		free(pool_store);
 		pool_store_size = 0;
 		pool_store_capacity = 0;
+		pool_store_hole = 0;
 		pool_store = NULL;
+		free(route_table);
+		route_table = NULL;
+		pthread_rwlock_wrlock(&pool_map_lock);
+		_mem_map_free((uintptr_t) pool_map, 0);
+		pool_map = NULL;
+		pthread_rwlock_unlock(&pool_map_lock);
+		route_table_size = 0;
+		route_table_capacity = 0;
 		return ALLOC_OK;
 	}
 
@@ -143,6 +482,10 @@ alloc_status mem_free() {
 }
 
 pool_pt mem_pool_open(size_t size, alloc_policy policy) {
+	return mem_pool_open_opts(size, policy, NULL);
+}
+
+pool_pt mem_pool_open_opts(size_t size, alloc_policy policy, const pool_options_t *options) {
     // make sure there the pool store is allocated
     // expand the pool store, if necessary
     // allocate a new mem pool mgr
@@ -165,57 +508,430 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
 		if (status != ALLOC_OK) return NULL;
 	} else {
 		size = align(size);
+		if (size > MEM_NODE_SIZE_MASK) return NULL;
 		pool_mgr_pt poolMgr = (pool_mgr_pt) calloc(1,sizeof(pool_mgr_t));//TODO
 		if (!poolMgr){
 			return NULL;
 		} else {
+			pthread_mutex_init(&poolMgr->lock, NULL);
 			poolMgr->pool.alloc_size = 0;
 			poolMgr->pool.total_size =  (size);
 			poolMgr->pool.policy = policy;
 			poolMgr->pool.num_gaps = 0;
 			poolMgr->pool.num_allocs = 0;
-			poolMgr->pool.mem = (char*) malloc( (size));	//malloc
-			if (!(poolMgr->pool.mem)) {
+			if (_mem_map_pool(poolMgr, options) != ALLOC_OK) {
+				free(poolMgr);
+				return NULL;
+			}
+			_mem_numa_place(poolMgr, options);
+			//Node Heap and Gap Index Allocation
+			// sized by the capacity hints, if given: every allocation and
+			// every gap is a node, and the gap index grows at its fill factor
+			unsigned long nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+			unsigned long gaps = MEM_GAP_IX_INIT_CAPACITY;
+			if (options) {
+				const unsigned long hintNodes = options->expected_allocs + (unsigned long) options->expected_gaps + 1;
+				const unsigned long hintGaps = (unsigned long) ((options->expected_gaps + 1ul) / MEM_GAP_IX_FILL_FACTOR) + 1;
+				if (hintNodes > nodes) nodes = hintNodes;
+				if (hintGaps > gaps) gaps = hintGaps;
+			}
+			if (nodes > MEM_NO_NODE / 2 || gaps > MEM_NO_NODE / 2
+			    || _mem_alloc_metadata(poolMgr, (unsigned) nodes, (unsigned) gaps) != ALLOC_OK) {
+				munmap(poolMgr->pool.mem, poolMgr->reserved_size);
 				free(poolMgr);
 				return NULL;
 			}
-			//Node Heap Allocation
-			poolMgr->node_heap = (node_pt) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(node_t));
-			poolMgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
-			poolMgr->used_nodes = 0;
-			if (!poolMgr->node_heap){
-				free(poolMgr->pool.mem);
+			//Allocate first node, the whole pool as one gap
+			if (_mem_init_head(poolMgr) != ALLOC_OK) {
+				munmap(poolMgr->pool.mem, poolMgr->reserved_size);
+				free(poolMgr->gap_ix);
+				_mem_free_node_heap(&poolMgr->node_heap);
 				free(poolMgr);
 				return NULL;
 			}
-			//Gap Index Allocation
-			poolMgr->gap_ix = (gap_pt) calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
-			poolMgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
-			if (!poolMgr->gap_ix){
-				free(poolMgr->pool.mem);
-				free(poolMgr->node_heap);
+			// after placement, so the pages are faulted in on the right node,
+			// and after the head gap, whose adding gives its pages back
+			if (poolMgr->flags & POOL_PREFAULT) _mem_prefault(poolMgr->pool.mem, poolMgr->mapped_size);
+			if (poolMgr->flags & POOL_QUICK_BINS) {
+				_mem_quick_enable(poolMgr); // coalesce right away if it fails
+			}
+			poolMgr->large_threshold = options ? options->large_threshold : 0;
+			if (poolMgr->flags & POOL_SMALL_OBJECTS) {
+				poolMgr->small_partial = (small_slab_pt *) calloc(MEM_SMALL_MAX / MEM_SMALL_GRANULE, sizeof(small_slab_pt));
+				if (poolMgr->small_partial == NULL) poolMgr->flags &= ~POOL_SMALL_OBJECTS; // nodes for everything
+			}
+			if (_mem_add_to_pool_store(poolMgr) != ALLOC_OK) {
+				munmap(poolMgr->pool.mem, poolMgr->reserved_size);
+				free(poolMgr->gap_ix);
+				free(poolMgr->quick_bins);
+				free(poolMgr->small_partial);
+				_mem_free_node_heap(&poolMgr->node_heap);
 				free(poolMgr);
 				return NULL;
 			}
-			//Allocate first node
-			const node_pt head = _add_node(poolMgr, NULL);
-			head->alloc_record.mem = poolMgr->pool.mem;
-			head->alloc_record.size =  (poolMgr->pool.total_size);
-			head->next = NULL;
-			head->prev = NULL;
-			head->used = 1;
-			head->allocated = 1;
-			
-			//Add head
-			_add_gap(poolMgr, head);
-			pool_store[pool_store_size] = poolMgr;
-			pool_store_size++;
 			return (pool_pt)poolMgr;
 		}
 	}
     return NULL;
 }
 
+pool_pt mem_pool_open_sub(pool_pt parent, size_t size, alloc_policy policy) {
+    // a pool whose memory is a single allocation of parent, given back to
+    // it by mem_pool_close; no mapping of its own, so it is cheap to make
+    // and throw away. The parent can't close while its sub-pools are open
+	const pool_mgr_pt parentMgr = (pool_mgr_pt) parent;
+	if (!pool_store || parentMgr == NULL || parentMgr->backing == BACKING_FILE) return NULL;
+	size = align(size);
+	const alloc_pt region = mem_new_alloc(parent, size);
+	if (region == NULL) return NULL;
+	pool_mgr_pt poolMgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+	if (!poolMgr) {
+		mem_del_alloc(parent, region);
+		return NULL;
+	}
+	pthread_mutex_init(&poolMgr->lock, NULL);
+	poolMgr->backing = BACKING_PARENT;
+	poolMgr->parent = parentMgr;
+	poolMgr->parent_alloc = region;
+	poolMgr->page_size = parentMgr->page_size;
+	poolMgr->pool.mem = region->mem;
+	poolMgr->pool.total_size = size;
+	poolMgr->pool.policy = policy;
+	poolMgr->mapped_size = size;
+	poolMgr->reserved_size = size;
+
+	alloc_status status = _mem_alloc_metadata(poolMgr, MEM_NODE_HEAP_INIT_CAPACITY, MEM_GAP_IX_INIT_CAPACITY);
+	if (status == ALLOC_OK) status = _mem_init_head(poolMgr);
+	if (status == ALLOC_OK) status = _mem_add_to_pool_store(poolMgr);
+	if (status != ALLOC_OK) {
+		mem_del_alloc(parent, region);
+		free(poolMgr->gap_ix);
+		_mem_free_node_heap(&poolMgr->node_heap);
+		free(poolMgr);
+		return NULL;
+	}
+	return (pool_pt) poolMgr;
+}
+
+pool_pt mem_pool_open_file(const char *path, size_t size, alloc_policy policy) {
+    // map the file as pool memory; a file written by an earlier process
+    // comes back with its node heap and gap index exactly as they were
+	if (!pool_store || path == NULL || align(size) > MEM_NODE_SIZE_MASK) return NULL;
+
+	const int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) return NULL;
+	struct stat st;
+	pool_file_header_t header;
+	int existing = 0;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+	if ((size_t) st.st_size >= sizeof(header)) {
+		if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)
+		    || memcmp(header.magic, MEM_FILE_MAGIC, sizeof(MEM_FILE_MAGIC)) != 0
+		    || header.version != MEM_FILE_VERSION) {
+			close(fd); // not a pool file, don't clobber it
+			return NULL;
+		}
+		existing = 1;
+	}
+
+	pool_mgr_pt poolMgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+	if (!poolMgr) {
+		close(fd);
+		return NULL;
+	}
+	pthread_mutex_init(&poolMgr->lock, NULL);
+	poolMgr->backing = BACKING_FILE;
+	poolMgr->fd = fd;
+	poolMgr->page_size = (size_t) sysconf(_SC_PAGESIZE);
+	poolMgr->data_offset = poolMgr->page_size; // header gets the first page
+	poolMgr->pool.policy = policy;
+	poolMgr->pool.total_size = existing ? (size_t) header.total_size : align(size);
+	poolMgr->mapped_size = (poolMgr->pool.total_size + poolMgr->page_size - 1) & ~(poolMgr->page_size - 1);
+	poolMgr->reserved_size = poolMgr->mapped_size;
+	if (existing) poolMgr->data_offset = (size_t) header.data_offset;
+
+	if ((!existing && ftruncate(fd, (off_t) (poolMgr->data_offset + poolMgr->mapped_size)) != 0)
+	    || (poolMgr->pool.mem = (char *) mmap(NULL, poolMgr->mapped_size, PROT_READ | PROT_WRITE,
+	                                          MAP_SHARED, fd, (off_t) poolMgr->data_offset)) == MAP_FAILED) {
+		close(fd);
+		free(poolMgr);
+		return NULL;
+	}
+
+	alloc_status status;
+	if (existing) {
+		status = _mem_file_load(poolMgr, &header);
+	} else {
+		status = _mem_alloc_metadata(poolMgr, MEM_NODE_HEAP_INIT_CAPACITY, MEM_GAP_IX_INIT_CAPACITY);
+		if (status == ALLOC_OK) status = _mem_init_head(poolMgr);
+		if (status == ALLOC_OK) status = _mem_file_sync(poolMgr);
+	}
+	if (status == ALLOC_OK) status = _mem_add_to_pool_store(poolMgr);
+	if (status != ALLOC_OK) {
+		munmap(poolMgr->pool.mem, poolMgr->mapped_size);
+		close(fd);
+		free(poolMgr->gap_ix);
+		_mem_free_node_heap(&poolMgr->node_heap);
+		free(poolMgr);
+		return NULL;
+	}
+	return (pool_pt) poolMgr;
+}
+
+alloc_status mem_pool_sync(pool_pt pool) {
+	const pool_mgr_pt poolMgr = (pool_mgr_pt) pool;
+	if (poolMgr == NULL || poolMgr->backing != BACKING_FILE) return ALLOC_FAIL;
+	pthread_mutex_lock(&poolMgr->lock);
+	const alloc_status status = _mem_file_sync(poolMgr);
+	pthread_mutex_unlock(&poolMgr->lock);
+	return status;
+}
+
+alloc_status mem_pool_trim(pool_pt pool, size_t keep_bytes) {
+    // shrink the pool down to keep_bytes of trailing gap, giving the tail of
+    // the mapping back to the OS, then release the free pages of all gaps
+	const pool_mgr_pt poolMgr = (pool_mgr_pt) pool;
+	if (poolMgr == NULL) return ALLOC_FAIL;
+	pthread_mutex_lock(&poolMgr->lock);
+	const alloc_status status = _mem_trim(poolMgr, keep_bytes);
+	pthread_mutex_unlock(&poolMgr->lock);
+	return status;
+}
+
+size_t mem_pool_compact(pool_pt pool, unsigned long budget_us) {
+    // slide movable allocations down into the gaps before them, merging the
+    // gaps as they go, until there is nothing left to slide or budget_us is
+    // used up (0 for no limit); returns the bytes moved, 0 once compact
+	const pool_mgr_pt poolMgr = (pool_mgr_pt) pool;
+	if (poolMgr == NULL) return 0;
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t moved = 0;
+	pthread_mutex_lock(&poolMgr->lock);
+	_mem_quick_flush(poolMgr);
+	const node_heap_pt heap = &poolMgr->node_heap;
+	unsigned current = poolMgr->head;
+	while (current != MEM_NO_NODE) {
+		const unsigned next = _node_next(heap, current);
+		if (_node_flags(heap, current) != NODE_USED || next == MEM_NO_NODE
+		    || !(_node_flags(heap, next) & NODE_MOVABLE)) {
+			current = next; // pinned allocations stay where they are
+			continue;
+		}
+		moved += _mem_slide(poolMgr, current, next); // current is still the gap
+		if (budget_us) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			const long elapsed = (now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000;
+			if ((unsigned long) elapsed >= budget_us) break;
+		}
+	}
+	// the gaps that moved are resident again; give their pages back now,
+	// unless the scavenger is left to do it once they've been idle
+	if (!atomic_load_explicit(&scavenger_running, memory_order_relaxed)) {
+		for (unsigned int i = 0; i < poolMgr->pool.num_gaps; i++) {
+			const gap_pt gap = &(poolMgr->gap_ix[i]);
+			const size_t size = _node_size(heap, gap->node);
+			if (gap->released || size < MEM_RELEASE_THRESHOLD) continue;
+			char *mem = _node_record(heap, gap->node)->mem;
+			_mem_release_pages(poolMgr, gap->node, mem, mem + size);
+			gap->released = (uint32_t) ((size + poolMgr->page_size - 1) / poolMgr->page_size);
+		}
+	}
+	pthread_mutex_unlock(&poolMgr->lock);
+	return moved;
+}
+
+alloc_status mem_pool_stats(pool_pt pool, pool_stats_pt stats) {
+    // everything here is kept up to date as gaps come and go, so this
+    // never walks the node heap the way mem_inspect_pool does
+	const pool_mgr_pt poolMgr = (pool_mgr_pt) pool;
+	if (poolMgr == NULL || stats == NULL) return ALLOC_FAIL;
+	pthread_mutex_lock(&poolMgr->lock);
+	stats->free_bytes = poolMgr->pool.total_size - (poolMgr->pool.alloc_size - poolMgr->large_bytes);
+	stats->binned_bytes = poolMgr->binned_bytes;
+	stats->num_gaps = poolMgr->pool.num_gaps;
+	// the gap index is sorted by size, the largest gap is the last one
+	stats->largest_gap = stats->num_gaps ?
+	                     _node_size(&poolMgr->node_heap, poolMgr->gap_ix[stats->num_gaps - 1].node) : 0;
+	memcpy(stats->gap_histogram, poolMgr->gap_histogram, sizeof(stats->gap_histogram));
+	stats->fit = poolMgr->pool.policy == AUTO_FIT ? poolMgr->auto_fit.fit : poolMgr->pool.policy;
+	stats->quick_bins = poolMgr->quick_bins != NULL;
+	pthread_mutex_unlock(&poolMgr->lock);
+	stats->fragmentation = stats->free_bytes ?
+	                       1.0 - (double) stats->largest_gap / (double) stats->free_bytes : 0.0;
+	return ALLOC_OK;
+}
+
+alloc_status mem_scavenger_start(const scavenger_options_t *options) {
+    // one scavenger per library; from now on mem_del_alloc leaves the
+    // pages of freed memory resident until the scavenger finds them idle
+	if (atomic_load(&scavenger_running)) return ALLOC_CALLED_AGAIN;
+	if (options) {
+		scavenger_options = *options;
+	} else {
+		scavenger_options.interval_ms = MEM_SCAVENGER_INTERVAL_MS;
+		scavenger_options.idle_ms = MEM_SCAVENGER_IDLE_MS;
+		scavenger_options.max_bytes_per_pass = MEM_SCAVENGER_MAX_BYTES_PER_PASS;
+	}
+	if (scavenger_options.interval_ms == 0) return ALLOC_FAIL;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&scavenger_wake, &attr);
+	pthread_condattr_destroy(&attr);
+	memset(&scavenger_stats, 0, sizeof(scavenger_stats));
+	scavenger_stopping = 0;
+	atomic_store(&scavenger_running, 1);
+	if (pthread_create(&scavenger_thread, NULL, _mem_scavenger_main, NULL) != 0) {
+		atomic_store(&scavenger_running, 0);
+		pthread_cond_destroy(&scavenger_wake);
+		return ALLOC_FAIL;
+	}
+	return ALLOC_OK;
+}
+
+alloc_status mem_scavenger_stop() {
+    // frees go back to releasing pages synchronously; gaps left
+    // unreleased stay resident until the next trim or free into them
+	if (!atomic_load(&scavenger_running)) return ALLOC_CALLED_AGAIN;
+	pthread_mutex_lock(&scavenger_lock);
+	scavenger_stopping = 1;
+	pthread_cond_signal(&scavenger_wake);
+	pthread_mutex_unlock(&scavenger_lock);
+	pthread_join(scavenger_thread, NULL);
+	pthread_cond_destroy(&scavenger_wake);
+	atomic_store(&scavenger_running, 0);
+	return ALLOC_OK;
+}
+
+void mem_scavenger_stats(scavenger_stats_pt stats) {
+	pthread_mutex_lock(&scavenger_lock);
+	*stats = scavenger_stats;
+	pthread_mutex_unlock(&scavenger_lock);
+}
+
+pool_shards_pt mem_pool_open_sharded(size_t size, alloc_policy policy, const pool_options_t *options) {
+    // one pool per NUMA node, each bound to its node; pools are not
+    // thread-safe, so threads sharing a node still serialize on its shard
+	numa_mask_t online;
+	const unsigned nodes = _mem_numa_online(&online);
+	pool_options_t shardOptions = { .flags = 0 };
+	if (options) shardOptions = *options;
+	shardOptions.flags &= ~POOL_NUMA_INTERLEAVE;
+	shardOptions.flags |= POOL_NUMA_BIND;
+
+	const pool_shards_pt shards = (pool_shards_pt) calloc(1, sizeof(pool_shards_t));
+	if (!shards) return NULL;
+	shards->pools = (pool_pt *) calloc(nodes, sizeof(pool_pt));
+	if (!shards->pools) {
+		free(shards);
+		return NULL;
+	}
+	shards->num_shards = nodes;
+	for (unsigned int n = 0; n < nodes; n++) {
+		shardOptions.numa_node = (int) n;
+		shards->pools[n] = mem_pool_open_opts(size, policy, &shardOptions);
+		if (shards->pools[n] == NULL) {
+			mem_pool_close_sharded(shards);
+			return NULL;
+		}
+	}
+	return shards;
+}
+
+pool_pt mem_pool_shard(pool_shards_pt shards) {
+    // the shard of the node the calling thread is running on right now
+	unsigned cpu = 0, node = 0;
+	if (shards == NULL) return NULL;
+	if (getcpu(&cpu, &node) != 0 || node >= shards->num_shards) node = 0;
+	return shards->pools[node];
+}
+
+alloc_status mem_pool_close_sharded(pool_shards_pt shards) {
+    // closes every shard it can; the set survives if any still has allocations
+	if (shards == NULL) return ALLOC_FAIL;
+	alloc_status status = ALLOC_OK;
+	for (unsigned int n = 0; n < shards->num_shards; n++) {
+		if (shards->pools[n] == NULL) continue;
+		if (mem_pool_close(shards->pools[n]) == ALLOC_OK) {
+			shards->pools[n] = NULL;
+		} else {
+			status = ALLOC_NOT_FREED;
+		}
+	}
+	if (status == ALLOC_OK) {
+		free(shards->pools);
+		free(shards);
+	}
+	return status;
+}
+
+alloc_status mem_pool_route(pool_pt pool, size_t max_size) {
+    // mem_new_alloc_routed sends requests of up to max_size bytes, and
+    // above the next smaller class, to pool; MEM_ROUTE_REST takes the rest.
+    // A class registered again moves to the new pool
+	if (pool == NULL || max_size == 0) return ALLOC_FAIL;
+	pthread_mutex_lock(&pool_store_lock);
+	unsigned int r = 0;
+	while (r < route_table_size && route_table[r].max_size < max_size) r++;
+	if (r == route_table_size || route_table[r].max_size != max_size) {
+		if (route_table_size == route_table_capacity) {
+			const unsigned capacity = route_table_capacity
+			                          ? route_table_capacity * MEM_ROUTE_TABLE_EXPAND_FACTOR
+			                          : MEM_ROUTE_TABLE_INIT_CAPACITY;
+			size_route_pt table = (size_route_pt) realloc(route_table, capacity * sizeof(size_route_t));
+			if (table == NULL) {
+				pthread_mutex_unlock(&pool_store_lock);
+				return ALLOC_FAIL;
+			}
+			route_table = table;
+			route_table_capacity = capacity;
+		}
+		memmove(&route_table[r + 1], &route_table[r], (route_table_size - r) * sizeof(size_route_t));
+		route_table_size++;
+	}
+	route_table[r].max_size = max_size;
+	route_table[r].pool = (pool_mgr_pt) pool;
+	pthread_mutex_unlock(&pool_store_lock);
+	return ALLOC_OK;
+}
+
+pool_pt mem_pool_of(const char *mem) {
+    // the open pool that mem points into, large allocations included;
+    // a walk down the radix tree, no matter how many pools there are
+	const uintptr_t page = (uintptr_t) mem >> MEM_MAP_PAGE_SHIFT;
+	pool_mgr_pt owner = NULL;
+	if (page >> (MEM_MAP_BITS * MEM_MAP_LEVELS)) return NULL;
+	pthread_rwlock_rdlock(&pool_map_lock);
+	const uintptr_t *node = pool_map;
+	for (unsigned int level = 0; node != NULL && level < MEM_MAP_LEVELS; level++) {
+		const unsigned shift = MEM_MAP_BITS * (MEM_MAP_LEVELS - 1 - level);
+		const uintptr_t entry = node[(page >> shift) & ((1u << MEM_MAP_BITS) - 1)];
+		if (entry & 1) {
+			owner = (pool_mgr_pt) (entry & ~(uintptr_t) 1);
+			break;
+		}
+		node = (const uintptr_t *) entry;
+	}
+	while (owner != NULL && owner->num_subs > 0) {
+		// inside a sub-pool's region, the sub-pool owns it
+		unsigned int lo = 0, hi = owner->num_subs;
+		while (hi - lo > 1) {
+			const unsigned mid = (lo + hi) / 2;
+			if (owner->subs[mid]->pool.mem <= mem) lo = mid; else hi = mid;
+		}
+		const pool_mgr_pt sub = owner->subs[lo];
+		if (mem < sub->pool.mem || mem >= sub->pool.mem + sub->pool.total_size) break;
+		owner = sub;
+	}
+	pthread_rwlock_unlock(&pool_map_lock);
+	return (pool_pt) owner;
+}
+
 alloc_status mem_pool_close(pool_pt pool) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     // check if this pool is allocated
@@ -232,22 +948,59 @@ alloc_status mem_pool_close(pool_pt pool) {
 		//printf("Failed to find pool\n");
 		return ALLOC_FAIL;
 	} else {
-		for (unsigned int i=0; i< poolMgr->used_nodes; i++) {
-			if (poolMgr->node_heap[i].allocated) {
-				return ALLOC_NOT_FREED;
+		// still in the store, so the scavenger may be walking the gap
+		// index: everything up to taking the pool out is under its lock.
+		// Persistent pools are closed with their allocations in place
+		alloc_status status = ALLOC_OK;
+		pthread_mutex_lock(&poolMgr->lock);
+		if (poolMgr->backing == BACKING_FILE) {
+			status = _mem_file_sync(poolMgr);
+		} else {
+			if (poolMgr->num_large_allocs > 0) status = ALLOC_NOT_FREED;
+			// slabs left over hold live small objects, or are empty and go now
+			for (unsigned int s = 0; s < poolMgr->num_small_slabs && status == ALLOC_OK; s++) {
+				if (poolMgr->small_slabs[s]->num_free < MEM_SMALL_SLAB_SLOTS) status = ALLOC_NOT_FREED;
+			}
+			while (status == ALLOC_OK && poolMgr->num_small_slabs > 0) {
+				_mem_small_release_slab(poolMgr, poolMgr->small_slabs[0]);
+			}
+			for (unsigned int i=0; i< poolMgr->used_nodes && status == ALLOC_OK; i++) {
+				if (_node_flags(&poolMgr->node_heap, i) & NODE_ALLOCATED) {
+					status = ALLOC_NOT_FREED;
+				}
 			}
 		}
+		pthread_mutex_unlock(&poolMgr->lock);
+		if (status != ALLOC_OK) return status;
 		if (poolMgr->pool.num_allocs <= 0) {
 			//return ALLOC_NOT_FREED;
 		}
-		for (unsigned int i = 0; i < pool_store_size; i++) {
-			if (pool_store[i] == poolMgr) {
-				pool_store[i] = NULL;
-			}
+		// once out of the store, the scavenger can't be looking at it
+		pthread_mutex_lock(&pool_store_lock);
+		pool_store[poolMgr->store_index] = NULL;
+		if (poolMgr->store_index < pool_store_hole) pool_store_hole = poolMgr->store_index;
+		_mem_remove_routes(poolMgr);
+		if (poolMgr->backing == BACKING_PARENT) {
+			_mem_map_sub(poolMgr, 0);
+		} else {
+			_mem_map_range(poolMgr->pool.mem, poolMgr->reserved_size, NULL);
+		}
+		pthread_mutex_unlock(&pool_store_lock);
+		pthread_mutex_destroy(&poolMgr->lock);
+		if (poolMgr->backing == BACKING_PARENT) {
+			// the whole region goes back to the parent as one allocation
+			mem_del_alloc((pool_pt) poolMgr->parent, poolMgr->parent_alloc);
+		} else {
+			munmap(poolMgr->pool.mem, poolMgr->reserved_size);
 		}
-		free(poolMgr->pool.mem);
+		if (poolMgr->backing == BACKING_FILE) close(poolMgr->fd);
 		free(poolMgr->gap_ix);
-		free(poolMgr->node_heap);
+		free(poolMgr->quick_bins);
+		free(poolMgr->small_partial);
+		free(poolMgr->small_slabs);
+		free(poolMgr->large_allocs);
+		free(poolMgr->subs);
+		_mem_free_node_heap(&poolMgr->node_heap);
 		free(poolMgr);
 		return ALLOC_OK;
 	}
@@ -258,99 +1011,95 @@ alloc_status mem_pool_close(pool_pt pool) {
 alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
 	const pool_mgr_pt poolMgr = (pool_mgr_pt)pool;
-    // check if any gaps, return null if none
-	if (poolMgr->pool.num_gaps < 1) return NULL;
-    // expand heap node, if necessary, quit on error
-	if (poolMgr->total_nodes > MEM_NODE_HEAP_INIT_CAPACITY*MEM_NODE_HEAP_FILL_FACTOR) {
-		
-	}
-    // check used nodes fewer than total nodes, quit on error
-	if (poolMgr->total_nodes < poolMgr->used_nodes) {
-		return NULL;
-	}
-    // get a node for allocation
-    // if FIRST_FIT, then find the first sufficient node in the node heap
-    // if BEST_FIT, then find the first sufficient node in the gap index
-    // check if node found
-    // update metadata (num_allocs, alloc_size)
-    // calculate the size of the remaining gap, if any
-    // remove node from gap index
-    // convert gap_node to an allocation node of given size
-    // adjust node heap:
-    //   if remaining gap, need a new node
-    //   find an unused one in the node heap
-    //   make sure one was found
-    //   initialize it to a gap node
-    //   update metadata (used_nodes)
-    //   update linked list (new node right after the node for allocation)
-    //   add to gap index
-    //   check if successful
-    // return allocation record by casting the node to (alloc_pt)
-	
-	node_pt new = NULL;
-	node_pt best = NULL;	
-	node_pt current = poolMgr->node_heap;
-	//size = align(size);
-	if (poolMgr->pool.policy == FIRST_FIT) {
-		while (current) {
-			if (current->used == 1 && current->allocated == 0) {
-				if (current->alloc_record.size >= size) {
-					best = current;
-					break;
-				}
-			}
-			current = current->next;
-		}
+	alloc_pt alloc = NULL;
+    // a large one is mapped on its own instead of splitting a gap
+	if (poolMgr->large_threshold && size > poolMgr->large_threshold) {
+		return _mem_large_alloc(poolMgr, size);
 	}
-
-	if (poolMgr->pool.policy == BEST_FIT) {
-		while (current) {
-			if (current->used == 1 && current->allocated == 0) {
-				if(current->alloc_record.size >= size) {
-					if (best != NULL) {
-						if (current->alloc_record.size < best->alloc_record.size) {
-							best = current;
-						}
-					} else {
-						best = current;
-					}
-				}
-			}
-			current = current->next;
-		}
+	pthread_mutex_lock(&poolMgr->lock);
+    // small objects come from a slab slot, anything else (or a full pool) gets a node
+	if (poolMgr->small_partial != NULL && size > 0 && size <= MEM_SMALL_MAX) {
+		alloc = _mem_small_alloc(poolMgr, size);
 	}
-	if (best != NULL) {
-		for (unsigned int i = 0; i < poolMgr->pool.num_gaps; i++) {
-			if (poolMgr->gap_ix[i].node == best) {
-				new = (node_pt) _convert_gap(poolMgr, &(poolMgr->gap_ix[i]),  (size));
-				break;
-			}
-		}
+	if (alloc == NULL) {
+		const unsigned node = _mem_new_node(poolMgr, size);
+		if (node != MEM_NO_NODE) alloc = _node_record(&poolMgr->node_heap, node);
 	}
-	if (new) {
+    // update metadata (num_allocs, alloc_size)
+	if (alloc != NULL) {
 		poolMgr->pool.num_allocs++;
 		poolMgr->pool.alloc_size +=  (size);
-		return &(new->alloc_record);
-	} 
+	}
+	if (poolMgr->pool.policy == AUTO_FIT) _mem_auto_alloc(poolMgr, size, alloc);
+	pthread_mutex_unlock(&poolMgr->lock);
+	return alloc;
+}
 
-    return NULL;
+alloc_pt mem_new_handle(pool_pt pool, size_t size) {
+    // like mem_new_alloc, but mem_pool_compact may move the allocation and
+    // update handle->mem, so go through the handle on every access
+	// (always a node, slab slots don't move)
+	const pool_mgr_pt poolMgr = (pool_mgr_pt) pool;
+	alloc_pt handle = NULL;
+	pthread_mutex_lock(&poolMgr->lock);
+	const unsigned node = _mem_new_node(poolMgr, size);
+	if (node != MEM_NO_NODE) {
+		_set_node_flags(&poolMgr->node_heap, node, NODE_USED | NODE_ALLOCATED | NODE_MOVABLE);
+		poolMgr->pool.num_allocs++;
+		poolMgr->pool.alloc_size += size;
+		handle = _node_record(&poolMgr->node_heap, node);
+	}
+	if (poolMgr->pool.policy == AUTO_FIT) _mem_auto_alloc(poolMgr, size, handle);
+	pthread_mutex_unlock(&poolMgr->lock);
+	return handle;
 }
 
 alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
 	const pool_mgr_pt poolMgr = (pool_mgr_pt)pool;
-    // get node from alloc by casting the pointer to (node_pt)
-	const node_pt node = (node_pt)alloc;
+	alloc_status status = ALLOC_FAIL;
+	pthread_mutex_lock(&poolMgr->lock);
     // save node size
 	size_t nodeSize = (alloc->size);
-    // convert to gap node
-	if (_mem_add_to_gap_ix(poolMgr, nodeSize, node) == ALLOC_OK){
+    // a large allocation leaves the side table and is unmapped right away
+	const unsigned large = _mem_large_find(poolMgr, alloc);
+	if (large != MEM_NO_NODE) {
+		const large_alloc_pt entry = poolMgr->large_allocs[large];
+		poolMgr->large_allocs[large] = poolMgr->large_allocs[--poolMgr->num_large_allocs];
+		poolMgr->pool.num_allocs--;
+		poolMgr->pool.alloc_size -= nodeSize;
+		poolMgr->large_bytes -= nodeSize;
+		pthread_mutex_unlock(&poolMgr->lock);
+		_mem_map_range(entry->record.mem, entry->mapped_size, NULL);
+		munmap(entry->record.mem, entry->mapped_size);
+		free(entry);
+		return ALLOC_OK;
+	}
+    // large allocations bypass the fit, so AUTO_FIT samples neither side of them
+	if (poolMgr->pool.policy == AUTO_FIT) _mem_auto_free(poolMgr, alloc);
+    // a slab slot goes back to its slab
+	const small_slab_pt slab = _mem_small_slab_of(poolMgr, alloc);
+	if (slab != NULL) {
+		status = _mem_small_free(poolMgr, slab, alloc);
+		if (status == ALLOC_OK) {
+			poolMgr->pool.num_allocs--;
+			poolMgr->pool.alloc_size -= nodeSize;
+		}
+		pthread_mutex_unlock(&poolMgr->lock);
+		return status;
+	}
+    // get node from alloc by its chunk and its position in it
+	const unsigned node = _mem_record_node(&poolMgr->node_heap, alloc);
+    // convert to gap node, or park it in a quick bin
+	if (node < poolMgr->used_nodes && (_node_flags(&poolMgr->node_heap, node) & NODE_ALLOCATED)
+	    && (_mem_quick_push(poolMgr, node) || _mem_add_to_gap_ix(poolMgr, nodeSize, node) == ALLOC_OK)){
     // update metadata (num_allocs, alloc_size)
 		poolMgr->pool.num_allocs--;
 		poolMgr->pool.alloc_size -=  (nodeSize);
-		return ALLOC_OK;
+		status = ALLOC_OK;
 	}
-    return ALLOC_FAIL;
+	pthread_mutex_unlock(&poolMgr->lock);
+    return status;
 /*
 // find the node in the node heap
 	node_pt current = poolMgr->node_heap;
@@ -371,28 +1120,88 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
 	}*/
 }
 
+alloc_pt mem_new_alloc_routed(size_t size) {
+    // allocate from the pool of the smallest size class that holds size
+	pool_pt pool = NULL;
+	pthread_mutex_lock(&pool_store_lock);
+	for (unsigned int r = 0; r < route_table_size; r++) {
+		if (route_table[r].max_size >= size) {
+			pool = (pool_pt) route_table[r].pool;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool_store_lock);
+	return pool ? mem_new_alloc(pool, size) : NULL;
+}
+
+alloc_status mem_del_alloc_routed(alloc_pt alloc) {
+    // free into whichever open pool the allocation came from
+	if (alloc == NULL) return ALLOC_FAIL;
+	const pool_pt pool = mem_pool_of(alloc->mem);
+	return pool ? mem_del_alloc(pool, alloc) : ALLOC_FAIL;
+}
+
+alloc_pt mem_find_alloc(pool_pt pool, const char *mem) {
+	const pool_mgr_pt poolMgr = (pool_mgr_pt) pool;
+	if (poolMgr == NULL) return NULL;
+	pthread_mutex_lock(&poolMgr->lock);
+	for (unsigned int l = 0; l < poolMgr->num_large_allocs; l++) {
+		if (poolMgr->large_allocs[l]->record.mem == mem) {
+			const alloc_pt record = &poolMgr->large_allocs[l]->record;
+			pthread_mutex_unlock(&poolMgr->lock);
+			return record;
+		}
+	}
+	for (unsigned int s = 0; s < poolMgr->num_small_slabs; s++) {
+		// inside a slab only its allocated slots are, not the slab node
+		const small_slab_pt slab = poolMgr->small_slabs[s];
+		if (mem >= slab->mem && mem < slab->mem + (size_t) MEM_SMALL_SLAB_SLOTS * slab->slot_size) {
+			const size_t offset = (size_t) (mem - slab->mem);
+			const unsigned slot = (unsigned) (offset / slab->slot_size);
+			const int free_slot = (slab->free_map[slot >> 6] >> (slot & 63)) & 1;
+			pthread_mutex_unlock(&poolMgr->lock);
+			return (offset % slab->slot_size == 0 && !free_slot) ? &slab->records[slot] : NULL;
+		}
+	}
+	const unsigned node = _mem_find_node(poolMgr, mem);
+	pthread_mutex_unlock(&poolMgr->lock);
+	return node != MEM_NO_NODE ? _node_record(&poolMgr->node_heap, node) : NULL;
+}
+
 void mem_inspect_pool(pool_pt pool,
                       pool_segment_pt *segments,
                       unsigned *num_segments) {
     // get the mgr from the pool
 	const pool_mgr_pt poolMgr = (pool_mgr_pt)pool;
-    // allocate the segments array with size == used_nodes
-	*segments = (pool_segment_pt) calloc(poolMgr->used_nodes, sizeof(pool_segment_t));
+    // allocate the segments array with size == used_nodes, and room for
+    // the large allocations, which follow the pool's own segments
+	pthread_mutex_lock(&poolMgr->lock);
+	*segments = (pool_segment_pt) calloc(poolMgr->used_nodes + poolMgr->num_large_allocs, sizeof(pool_segment_t));
     // check successful
-	if (!segments){
+	if (!*segments){
+		pthread_mutex_unlock(&poolMgr->lock);
+		*num_segments = 0;
 		return;
 	}
     // loop through the node heap and the segments array
-	node_pt current = poolMgr->node_heap;
+	_mem_quick_flush(poolMgr); // show binned blocks as the gaps they become
+	const node_heap_pt heap = &poolMgr->node_heap;
+	unsigned current = poolMgr->head;
 	unsigned int index = 0;
-	while(current) {
-		if (current->used == 1) {
-			(*segments)[index].size =  align (current->alloc_record.size);
-			(*segments)[index].allocated = current->allocated;
+	while(current != MEM_NO_NODE) {
+		if (_node_flags(heap, current) & NODE_USED) {
+			(*segments)[index].size =  align (_node_size(heap, current));
+			(*segments)[index].allocated = (_node_flags(heap, current) & NODE_ALLOCATED) ? 1 : 0;
 			index++;
 		}
-		current = current->next;
+		current = _node_next(heap, current);
+	}
+	for (unsigned int l = 0; l < poolMgr->num_large_allocs; l++) {
+		(*segments)[index].size = align(poolMgr->large_allocs[l]->record.size);
+		(*segments)[index].allocated = 1;
+		index++;
 	}
+	pthread_mutex_unlock(&poolMgr->lock);
 	*num_segments = index;
 	return;
     //    for each node, write the size and allocated in the segment
@@ -405,13 +1214,103 @@ void mem_inspect_pool(pool_pt pool,
 
 
 
+/******************************************/
+/*                                        */
+/* Definitions of object cache functions  */
+/*                                        */
+/******************************************/
+cache_pt mem_cache_create(pool_pt pool, size_t obj_size, size_t align, cache_ctor ctor, cache_dtor dtor) {
+    // objects are carved from slabs allocated in the pool, constructed once
+    // when the slab is created and destructed only when the slab is released
+	if (pool == NULL || obj_size == 0) return NULL;
+	if (align == 0) align = sizeof(void *);
+	if (align & (align - 1)) return NULL; // must be a power of two
+
+	const cache_mgr_pt cacheMgr = (cache_mgr_pt) calloc(1, sizeof(cache_mgr_t));
+	if (!cacheMgr) return NULL;
+	cacheMgr->slabs = (slab_pt *) calloc(MEM_CACHE_SLAB_STORE_INIT_CAPACITY, sizeof(slab_pt));
+	if (!cacheMgr->slabs) {
+		free(cacheMgr);
+		return NULL;
+	}
+	cacheMgr->slabs_capacity = MEM_CACHE_SLAB_STORE_INIT_CAPACITY;
+	cacheMgr->cache.pool = pool;
+	cacheMgr->cache.obj_size = obj_size;
+	cacheMgr->cache.align = align;
+	cacheMgr->ctor = ctor;
+	cacheMgr->dtor = dtor;
+	cacheMgr->stride = (obj_size + align - 1) & ~(align - 1);
+	cacheMgr->objs_per_slab = (unsigned) (MEM_CACHE_SLAB_SIZE / cacheMgr->stride);
+	if (cacheMgr->objs_per_slab < MEM_CACHE_SLAB_MIN_OBJS) {
+		cacheMgr->objs_per_slab = MEM_CACHE_SLAB_MIN_OBJS;
+	}
+	return (cache_pt) cacheMgr;
+}
+
+alloc_status mem_cache_destroy(cache_pt cache) {
+	const cache_mgr_pt cacheMgr = (cache_mgr_pt) cache;
+	if (cacheMgr == NULL) return ALLOC_FAIL;
+	if (cacheMgr->cache.num_objs > 0) return ALLOC_NOT_FREED;
+	while (cacheMgr->cache.num_slabs > 0) {
+		if (_mem_cache_release_slab(cacheMgr, cacheMgr->slabs[0]) != ALLOC_OK) {
+			return ALLOC_FAIL;
+		}
+	}
+	free(cacheMgr->slabs);
+	free(cacheMgr);
+	return ALLOC_OK;
+}
+
+void *mem_cache_alloc(cache_pt cache) {
+	const cache_mgr_pt cacheMgr = (cache_mgr_pt) cache;
+	if (cacheMgr == NULL) return NULL;
+	if (cacheMgr->partial == NULL) {
+		if (_mem_cache_add_slab(cacheMgr) != ALLOC_OK) return NULL;
+	}
+	// reuse the most recently freed object, it is already constructed
+	const slab_pt slab = cacheMgr->partial;
+	const unsigned ix = slab->free_ix[--slab->num_free];
+	if (slab->num_free == 0) {
+		cacheMgr->partial = slab->next_partial;
+		slab->next_partial = NULL;
+	}
+	cacheMgr->cache.num_objs++;
+	return slab->objs + ix * cacheMgr->stride;
+}
+
+alloc_status mem_cache_free(cache_pt cache, void *obj) {
+	const cache_mgr_pt cacheMgr = (cache_mgr_pt) cache;
+	if (cacheMgr == NULL || obj == NULL) return ALLOC_FAIL;
+	const slab_pt slab = _mem_cache_find_slab(cacheMgr, (char *) obj);
+	if (slab == NULL) return ALLOC_FAIL;
+	const size_t offset = (size_t) ((char *) obj - slab->objs);
+	if (offset % cacheMgr->stride) return ALLOC_FAIL;
+	if (slab->num_free == cacheMgr->objs_per_slab) return ALLOC_FAIL; // double free
+
+	slab->free_ix[slab->num_free++] = (unsigned) (offset / cacheMgr->stride);
+	cacheMgr->cache.num_objs--;
+	if (slab->num_free == 1) { // was full
+		slab->next_partial = cacheMgr->partial;
+		cacheMgr->partial = slab;
+	}
+	// release a completely free slab, but keep the last one with free objects
+	// around so that alloc/free ping-pong doesn't churn slabs in the pool
+	if (slab->num_free == cacheMgr->objs_per_slab
+	    && (cacheMgr->partial != slab || slab->next_partial != NULL)) {
+		return _mem_cache_release_slab(cacheMgr, slab);
+	}
+	return ALLOC_OK;
+}
+
+
+
 /***********************************/
 /*                                 */
 /* Definitions of static functions */
 /*                                 */
 /***********************************/
 static alloc_status _mem_resize_pool_store() {
-	if (((float) pool_store_size / pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
+	if (((float) pool_store_size / pool_store_capacity) < MEM_POOL_STORE_FILL_FACTOR) {
 		return ALLOC_OK;
 	}
 	pool_mgr_pt * tempMgr = (pool_mgr_pt*) realloc(pool_store, pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR * sizeof(pool_mgr_pt));	//TODO
@@ -425,70 +1324,270 @@ static alloc_status _mem_resize_pool_store() {
     return ALLOC_FAIL;
 }
 
-static alloc_status _mem_resize_node_heap(pool_mgr_pt poolMgr) {
-    // see above
-	if (poolMgr->used_nodes < poolMgr->total_nodes * MEM_NODE_HEAP_FILL_FACTOR) {
-		return ALLOC_OK;
+static alloc_status _mem_add_to_pool_store(pool_mgr_pt poolMgr) {
+	// the pool store only grows; a new pool takes the first slot a closed
+	// one left, or goes at the end, and mem_pool_of learns about its range
+	pthread_mutex_lock(&pool_store_lock);
+	alloc_status status = _mem_resize_pool_store();
+	if (status == ALLOC_OK) {
+		status = poolMgr->backing == BACKING_PARENT ? _mem_map_sub(poolMgr, 1)
+		                                            : _mem_map_range(poolMgr->pool.mem, poolMgr->reserved_size, poolMgr);
 	}
-
-	node_pt tempNode = (node_pt) realloc(poolMgr->node_heap, poolMgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR * sizeof(node_t));
-	if (tempNode != NULL) {
-		poolMgr->node_heap = tempNode;
-		poolMgr->total_nodes *= MEM_NODE_HEAP_EXPAND_FACTOR;
-		return ALLOC_OK;
+	if (status == ALLOC_OK) {
+		while (pool_store_hole < pool_store_size && pool_store[pool_store_hole] != NULL) pool_store_hole++;
+		poolMgr->store_index = pool_store_hole;
+		pool_store[pool_store_hole] = poolMgr;
+		if (pool_store_hole == pool_store_size) pool_store_size++;
+		pool_store_hole++;
 	}
-    return ALLOC_FAIL;
+	pthread_mutex_unlock(&pool_store_lock);
+	return status;
 }
 
-static alloc_status _mem_resize_gap_ix(pool_mgr_pt poolMgr) {
-    // see above
-	if (poolMgr->gap_ix_capacity < poolMgr->gap_ix_capacity * MEM_GAP_IX_FILL_FACTOR) {
-		return ALLOC_OK;
-	} else {
-		gap_pt temp = (gap_pt) realloc(poolMgr->gap_ix, poolMgr->gap_ix_capacity *MEM_GAP_IX_EXPAND_FACTOR *sizeof(gap_t));
-		if (temp != NULL) {
-			poolMgr->gap_ix = temp;
-			poolMgr->gap_ix_capacity *= MEM_GAP_IX_EXPAND_FACTOR;
-			return ALLOC_OK;
-		} 
-    return ALLOC_FAIL;
+static void _mem_remove_routes(pool_mgr_pt poolMgr) {
+	// a closed pool takes its size classes with it; under pool_store_lock
+	unsigned int kept = 0;
+	for (unsigned int r = 0; r < route_table_size; r++) {
+		if (route_table[r].pool != poolMgr) route_table[kept++] = route_table[r];
 	}
+	route_table_size = kept;
 }
 
-static alloc_status _mem_add_to_gap_ix(pool_mgr_pt poolMgr,
-                                       size_t size,
-                                       node_pt node) {
-    // expand the gap index, if necessary (call the function)
-	_mem_resize_gap_ix(poolMgr);
-    // add the entry at the end
-    // update metadata (num_gaps)
-    // sort the gap index (call the function)
-    // check success
-	
-    return _add_gap(poolMgr, node);
+static alloc_status _mem_map_range(const char *mem, size_t size, pool_mgr_pt owner) {
+	// point mem_pool_of at owner for every page of [mem, mem + size),
+	// or forget the range if owner is NULL
+	const uintptr_t lo = (uintptr_t) mem >> MEM_MAP_PAGE_SHIFT;
+	const uintptr_t hi = ((uintptr_t) mem + size + ((uintptr_t) 1 << MEM_MAP_PAGE_SHIFT) - 1) >> MEM_MAP_PAGE_SHIFT;
+	alloc_status status = ALLOC_OK;
+	if (hi <= lo) return ALLOC_OK;
+	if (hi >> (MEM_MAP_BITS * MEM_MAP_LEVELS)) return ALLOC_FAIL;
+	pthread_rwlock_wrlock(&pool_map_lock);
+	if (pool_map == NULL && owner != NULL) {
+		pool_map = (uintptr_t *) calloc((size_t) 1 << MEM_MAP_BITS, sizeof(uintptr_t));
+		if (pool_map == NULL) status = ALLOC_FAIL;
+	}
+	if (pool_map != NULL && status == ALLOC_OK) {
+		status = _mem_map_set(pool_map, 0, 0, lo, hi, owner ? (uintptr_t) owner | 1 : 0);
+		// out of memory part way: undo, which only ever clears slots
+		if (status != ALLOC_OK && owner != NULL) _mem_map_set(pool_map, 0, 0, lo, hi, 0);
+	}
+	pthread_rwlock_unlock(&pool_map_lock);
+	return status;
 }
 
-static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt poolMgr,
-                                            size_t size,
-                                            node_pt node) {
-    // find the position of the node in the gap index
-	node_pt current = poolMgr->node_heap;
-	unsigned int pos = 0;
-	for (unsigned int i = 0; i < poolMgr->pool.num_gaps; i++){
-		if (poolMgr->gap_ix[i].node == node) {
-			pos = i;
+static alloc_status _mem_map_set(uintptr_t *node, unsigned level, uintptr_t base,
+                                 uintptr_t lo, uintptr_t hi, uintptr_t value) {
+	// slots wholly inside [lo, hi) take value, the two at the ends of the
+	// range go down a level; base is the first page under node
+	const unsigned shift = MEM_MAP_BITS * (MEM_MAP_LEVELS - 1 - level);
+	const uintptr_t span = (uintptr_t) 1 << shift;
+	const unsigned first = (unsigned) ((lo > base ? lo - base : 0) >> shift);
+	const uintptr_t end = hi - base;
+	unsigned last = (unsigned) ((end - 1) >> shift);
+	if (last >= (1u << MEM_MAP_BITS)) last = (1u << MEM_MAP_BITS) - 1;
+	for (unsigned int slot = first; slot <= last; slot++) {
+		const uintptr_t slotLo = base + slot * span;
+		if (lo <= slotLo && slotLo + span <= hi) {
+			_mem_map_free(node[slot], level + 1);
+			node[slot] = value;
+			continue;
+		}
+		if (node[slot] == value) continue; // owned already, or nothing to forget
+		if (node[slot] == 0 || (node[slot] & 1)) {
+			// split the slot, keeping what it held for the pages outside the range
+			uintptr_t *child = (uintptr_t *) malloc(((size_t) 1 << MEM_MAP_BITS) * sizeof(uintptr_t));
+			if (child == NULL) return ALLOC_FAIL;
+			for (unsigned int c = 0; c < (1u << MEM_MAP_BITS); c++) child[c] = node[slot];
+			node[slot] = (uintptr_t) child;
+		}
+		uintptr_t *child = (uintptr_t *) node[slot];
+		if (_mem_map_set(child, level + 1, slotLo, lo, hi, value) != ALLOC_OK) return ALLOC_FAIL;
+		if (value == 0) {
+			// an emptied node goes
+			unsigned int c = 0;
+			while (c < (1u << MEM_MAP_BITS) && child[c] == 0) c++;
+			if (c == (1u << MEM_MAP_BITS)) {
+				free(child);
+				node[slot] = 0;
+			}
 		}
 	}
-    // loop from there to the end of the array:
-    //    pull the entries (i.e. copy over) one position up
-    //    this effectively deletes the chosen node
-	for (unsigned int j = pos; j < poolMgr->pool.num_gaps; j++){
-		poolMgr->gap_ix[j] = poolMgr->gap_ix[j+1];
+	return ALLOC_OK;
+}
+
+static void _mem_map_free(uintptr_t entry, unsigned level) {
+	// a child node and everything below it; leaves and empty slots own nothing
+	if (entry == 0 || (entry & 1)) return;
+	uintptr_t *node = (uintptr_t *) entry;
+	if (level < MEM_MAP_LEVELS - 1) {
+		for (unsigned int c = 0; c < (1u << MEM_MAP_BITS); c++) _mem_map_free(node[c], level + 1);
+	}
+	free(node);
+}
+
+static alloc_status _mem_map_sub(pool_mgr_pt poolMgr, int add) {
+	// enter a sub-pool in its parent's list for mem_pool_of, or take it out;
+	// the list is sorted by address, the regions never overlap
+	const pool_mgr_pt parent = poolMgr->parent;
+	alloc_status status = ALLOC_OK;
+	pthread_rwlock_wrlock(&pool_map_lock);
+	unsigned int pos = 0;
+	while (pos < parent->num_subs && parent->subs[pos]->pool.mem < poolMgr->pool.mem) pos++;
+	if (add) {
+		if (parent->num_subs == parent->subs_capacity) {
+			const unsigned capacity = parent->subs_capacity
+			                          ? parent->subs_capacity * MEM_SUB_POOLS_EXPAND_FACTOR
+			                          : MEM_SUB_POOLS_INIT_CAPACITY;
+			pool_mgr_pt *subs = (pool_mgr_pt *) realloc(parent->subs, capacity * sizeof(pool_mgr_pt));
+			if (subs == NULL) {
+				status = ALLOC_FAIL;
+			} else {
+				parent->subs = subs;
+				parent->subs_capacity = capacity;
+			}
+		}
+		if (status == ALLOC_OK) {
+			memmove(&parent->subs[pos + 1], &parent->subs[pos], (parent->num_subs - pos) * sizeof(pool_mgr_pt));
+			parent->subs[pos] = poolMgr;
+			parent->num_subs++;
+		}
+	} else if (pos < parent->num_subs && parent->subs[pos] == poolMgr) {
+		parent->num_subs--;
+		memmove(&parent->subs[pos], &parent->subs[pos + 1], (parent->num_subs - pos) * sizeof(pool_mgr_pt));
+	}
+	pthread_rwlock_unlock(&pool_map_lock);
+	return status;
+}
+
+static alloc_status _mem_resize_node_heap(pool_mgr_pt poolMgr) {
+    // see above
+	if (poolMgr->used_nodes < poolMgr->total_nodes) {
+		return ALLOC_OK;
+	}
+	// one more chunk; nothing already in the heap moves
+	const unsigned capacity = poolMgr->total_nodes + MEM_NODE_CHUNK_NODES;
+	if (_mem_reserve_node_heap(&poolMgr->node_heap, capacity) != ALLOC_OK) {
+		return ALLOC_FAIL;
+	}
+	poolMgr->total_nodes = capacity;
+	return ALLOC_OK;
+}
+
+static alloc_status _mem_reserve_node_heap(node_heap_pt heap, unsigned capacity) {
+	// add chunks until there is room for capacity nodes; only the chunk
+	// directory is ever reallocated, and it holds nothing the user sees
+	while (heap->num_chunks * MEM_NODE_CHUNK_NODES < capacity) {
+		if (heap->num_chunks == heap->chunks_capacity) {
+			const unsigned dirCapacity = heap->chunks_capacity ?
+			                             heap->chunks_capacity * MEM_NODE_DIR_EXPAND_FACTOR : MEM_NODE_DIR_INIT_CAPACITY;
+			char **dir = (char **) realloc(heap->chunks, dirCapacity * sizeof(char *));
+			if (dir == NULL) return ALLOC_FAIL;
+			heap->chunks = dir;
+			heap->chunks_capacity = dirCapacity;
+		}
+		void *chunk;
+		if (posix_memalign(&chunk, MEM_NODE_CHUNK_SIZE, MEM_NODE_CHUNK_SIZE + 2 * sizeof(unsigned)) != 0) {
+			return ALLOC_FAIL;
+		}
+		*_chunk_index((char *) chunk) = heap->num_chunks;
+		*_chunk_live((char *) chunk) = 0;
+		heap->chunks[heap->num_chunks++] = (char *) chunk;
+	}
+	return ALLOC_OK;
+}
+
+static void _mem_free_node_heap(node_heap_pt heap) {
+	for (unsigned int i = 0; i < heap->num_chunks; i++) {
+		free(heap->chunks[i]);
+	}
+	free(heap->chunks);
+	memset(heap, 0, sizeof(*heap));
+}
+
+static void _mem_shrink_node_heap(pool_mgr_pt poolMgr) {
+	// give back the trailing chunks with no live nodes, but keep one
+	// spare, so that a heap on a chunk boundary doesn't free and
+	// allocate a chunk in turn
+	const node_heap_pt heap = &poolMgr->node_heap;
+	while (heap->num_chunks > 1 && *_chunk_live(heap->chunks[heap->num_chunks - 1]) == 0
+	       && *_chunk_live(heap->chunks[heap->num_chunks - 2]) == 0) {
+		const unsigned first = (heap->num_chunks - 1) << MEM_NODE_CHUNK_SHIFT;
+		for (unsigned int node = first; node < poolMgr->used_nodes; node++) {
+			// all on the free list, take them off it
+			const unsigned next = _node_next(heap, node);
+			const unsigned prev = _node_prev(heap, node);
+			if (prev != MEM_NO_NODE) {
+				_set_node_next(heap, prev, next);
+			} else {
+				poolMgr->free_nodes = next;
+			}
+			if (next != MEM_NO_NODE) _set_node_prev(heap, next, prev);
+		}
+		free(heap->chunks[--heap->num_chunks]);
+		if (poolMgr->used_nodes > first) poolMgr->used_nodes = first;
+		poolMgr->total_nodes = first;
+	}
+}
+
+static unsigned _mem_record_node(const node_heap_t *heap, const alloc_t *record) {
+	// mask the record's address down to its chunk, and check that the
+	// chunk is one of ours before trusting its index
+	char *chunk = (char *) ((uintptr_t) record & ~(uintptr_t) (MEM_NODE_CHUNK_SIZE - 1));
+	if (record == NULL) return MEM_NO_NODE;
+	const unsigned index = *_chunk_index(chunk);
+	if (index >= heap->num_chunks || heap->chunks[index] != chunk) return MEM_NO_NODE;
+	const unsigned slot = (unsigned) (record - _chunk_records(chunk));
+	if (slot >= MEM_NODE_CHUNK_NODES) return MEM_NO_NODE; // in the meta or link columns
+	return (index << MEM_NODE_CHUNK_SHIFT) + slot;
+}
+
+static alloc_status _mem_resize_gap_ix(pool_mgr_pt poolMgr) {
+    // see above
+	if (poolMgr->pool.num_gaps < poolMgr->gap_ix_capacity * MEM_GAP_IX_FILL_FACTOR) {
+		return ALLOC_OK;
+	} else {
+		gap_pt temp = (gap_pt) realloc(poolMgr->gap_ix, poolMgr->gap_ix_capacity *MEM_GAP_IX_EXPAND_FACTOR *sizeof(gap_t));
+		if (temp != NULL) {
+			poolMgr->gap_ix = temp;
+			poolMgr->gap_ix_capacity *= MEM_GAP_IX_EXPAND_FACTOR;
+			return ALLOC_OK;
+		} 
+    return ALLOC_FAIL;
+	}
+}
+
+static alloc_status _mem_add_to_gap_ix(pool_mgr_pt poolMgr,
+                                       size_t size,
+                                       unsigned node) {
+    // expand the gap index, if necessary (call the function)
+	_mem_resize_gap_ix(poolMgr);
+    // add the entry at the end
+    // update metadata (num_gaps)
+    // sort the gap index (call the function)
+    // check success
+	
+    return _add_gap(poolMgr, node);
+}
+
+static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt poolMgr,
+                                            size_t size,
+                                            unsigned node) {
+    // find the position of the node in the gap index
+	const gap_pt gap = _mem_find_gap(poolMgr, node);
+	if (gap == NULL) return ALLOC_FAIL;
+	const unsigned int pos = (unsigned int) (gap - poolMgr->gap_ix);
+    // loop from there to the end of the array:
+    //    pull the entries (i.e. copy over) one position up
+    //    this effectively deletes the chosen node
+	for (unsigned int j = pos; j + 1 < poolMgr->pool.num_gaps; j++){
+		poolMgr->gap_ix[j] = poolMgr->gap_ix[j+1];
 	}
     // update metadata (num_gaps)
 	poolMgr->pool.num_gaps--;
+	_mem_count_gap(poolMgr, _node_size(&poolMgr->node_heap, node), -1);
     // zero out the element at position num_gaps!
-	poolMgr->gap_ix[poolMgr->pool.num_gaps].node = NULL;
+	poolMgr->gap_ix[poolMgr->pool.num_gaps].node = MEM_NO_NODE;
+	poolMgr->gap_ix[poolMgr->pool.num_gaps].released = 0;
     // sort the new gap index
 	_mem_sort_gap_ix(poolMgr);
     return ALLOC_OK;
@@ -496,8 +1595,8 @@ static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt poolMgr,
 
 // note: only called by _mem_add_to_gap_ix, which appends a single entry
 static alloc_status _mem_sort_gap_ix(pool_mgr_pt poolMgr) {
-	// Sort using a iterative bubblesort method
-	_sortGap(poolMgr->gap_ix, 0, poolMgr->pool.num_gaps - 1);
+	// Sort ascending by size
+	_sortGap(&poolMgr->node_heap, poolMgr->gap_ix, 0, poolMgr->pool.num_gaps - 1);
 	//Check success
 	/*for (unsigned int i = 0; i < poolMgr->pool.num_gaps; i++) {
 		if (poolMgr->gap_ix[i-1].size > poolMgr->gap_ix[i].size) return ALLOC_FAIL;
@@ -505,124 +1604,93 @@ static alloc_status _mem_sort_gap_ix(pool_mgr_pt poolMgr) {
     return ALLOC_OK;
 }
 
-static void _sortGap(gap_pt gapIX, int lower, int higher) {
-	int swapped = 1;	
-	while (swapped) {
-		swapped = 0;
-		for (int i = lower; i < higher; i++) {
-			gap_pt current = &(gapIX[i]);
-			gap_pt next = &(gapIX[i-1]);
-			if (next->size > current->size) {
-				gap_pt pivot = current;
-				current = next;
-				next = pivot;
-				swapped = 1;
-			}
+static void _sortGap(const node_heap_t *heap, gap_pt gapIX, int lower, int higher) {
+	// insertion sort: the index is sorted except for the one entry that was
+	// just added or resized, so this is a single linear pass
+	for (int i = lower + 1; i <= higher; i++) {
+		const gap_t current = gapIX[i];
+		const size_t size = _node_size(heap, current.node);
+		int j = i - 1;
+		while (j >= lower && _node_size(heap, gapIX[j].node) > size) {
+			gapIX[j + 1] = gapIX[j];
+			j--;
 		}
-		higher--;
+		gapIX[j + 1] = current;
 	}
-}		
+}
 
 
-static node_pt _add_node(pool_mgr_pt poolMgr, node_pt prevNode) {
-	//Try to find or make space	
-	if (_mem_resize_node_heap(poolMgr) != ALLOC_OK) return NULL;
-	const node_pt new = &(poolMgr->node_heap[poolMgr->used_nodes]);
-	poolMgr->used_nodes++;
-	new->next = NULL;
-	new->prev = NULL;
-	new->allocated = 0;
-	new->alloc_record.mem = NULL;
-	new->alloc_record.size = 0;
+static unsigned _add_node(pool_mgr_pt poolMgr, unsigned prevNode) {
+	const node_heap_pt heap = &poolMgr->node_heap;
+	unsigned new = poolMgr->free_nodes;
+	if (new != MEM_NO_NODE) {
+		// reuse an unlinked slot, so the sweeps stay bounded by the peak node count
+		poolMgr->free_nodes = _node_next(heap, new);
+		if (poolMgr->free_nodes != MEM_NO_NODE) _set_node_prev(heap, poolMgr->free_nodes, MEM_NO_NODE);
+	} else {
+		//Try to find or make space
+		if (_mem_resize_node_heap(poolMgr) != ALLOC_OK) return MEM_NO_NODE;
+		new = poolMgr->used_nodes;
+		poolMgr->used_nodes++;
+	}
+	(*_chunk_live(heap->chunks[new >> MEM_NODE_CHUNK_SHIFT]))++;
+	_node_record(heap, new)->mem = NULL;
+	_set_node_flags(heap, new, 0);
+	_set_node_size(heap, new, 0);
+	_set_node_next(heap, new, MEM_NO_NODE);
+	_set_node_prev(heap, new, MEM_NO_NODE);
 	if (poolMgr->used_nodes == 1) { // only one in heap
 		return new;
 	} else {
-		if (prevNode != NULL) { // previous node exists
-			new->prev = prevNode;
-			if (prevNode->next != NULL) {
-				new->next = prevNode->next;
+		if (prevNode != MEM_NO_NODE) { // previous node exists
+			_set_node_prev(heap, new, prevNode);
+			if (_node_next(heap, prevNode) != MEM_NO_NODE) {
+				_set_node_next(heap, new, _node_next(heap, prevNode));
+				_set_node_prev(heap, _node_next(heap, prevNode), new);
 			}
-			prevNode->next = new;
+			_set_node_next(heap, prevNode, new);
 		} else { // next node exists
-			node_pt end = poolMgr->node_heap;
-			while (end->next) end = end->next;
-			end->next = new;
-			new->prev = end;
+			const unsigned end = _mem_last_node(poolMgr);
+			_set_node_next(heap, end, new);
+			_set_node_prev(heap, new, end);
 		}
 		return new;
 	}
 }
 
-static alloc_status _add_gap(pool_mgr_pt poolMgr, node_pt node) {
-	gap_pt gap = NULL;
-//Merge gaps below
-	char* endAdd = ((char*) (node->alloc_record.mem) + node->alloc_record.size); //Find ending address to perform merge
-	if (!endAdd) return ALLOC_FAIL;
-	for (unsigned int i = 0; i < poolMgr->pool.num_gaps; i++) {
-		if (endAdd == poolMgr->gap_ix[i].node->alloc_record.mem) {
-			node_pt del = poolMgr->gap_ix[i].node;
-			del->used = 0;
-			if (del->prev != NULL) {
-				del->prev->next = del->next;
-			} else {
-				del->next->prev = NULL;
-			}
-			if (del->next != NULL) {
-				del->next->prev = del->prev;
-			} else {
-				del->prev->next = NULL;
-			}
-			//_mem_remove_from_gap_ix(poolMgr, del->alloc_record.size, del);
-			poolMgr->gap_ix[i].node = node;
-			node->allocated = 0;
-			poolMgr->gap_ix[i].size +=  (node->alloc_record.size);
-			poolMgr->gap_ix[i].node->alloc_record.size =  (poolMgr->gap_ix[i].size);
-			gap = &(poolMgr->gap_ix[i]);
-			//poolMgr->total_nodes--;
-			break;
-			//return ALLOC_OK;
-		}
-	}
-//Merge gaps above
-	for (unsigned int j = 0; j < poolMgr->pool.num_gaps; j++) {
-		node_pt current = poolMgr->gap_ix[j].node;
-		assert(current!=NULL); 
-		const char * gapEnd = (((char*) poolMgr->gap_ix[j].node->alloc_record.mem) + poolMgr->gap_ix[j].node->alloc_record.size);
-		if (node->alloc_record.mem == gapEnd) {
-			node_pt del = node;
-			del->used = 0;
-			if (del->prev != NULL) {
-				del->prev->next = del->next;
-			} else {
-				del->next->prev = NULL;
-			}
-			if (del->next != NULL) {
-				del->next->prev = del->prev;
-			} else {
-				del->prev->next = NULL;
-			}
-			//_mem_remove_from_gap_ix(poolMgr, del->alloc_record.size, del);
-			node->allocated = 0;
-			poolMgr->gap_ix[j].node->allocated = 0;
-			poolMgr->gap_ix[j].size +=  (node->alloc_record.size);
-			poolMgr->gap_ix[j].node->alloc_record.size =  (poolMgr->gap_ix[j].size);
-			if (gap!=NULL) {
-				//_mem_remove_from_gap_ix(poolMgr, gap->size, gap->node);
-				const gap_pt end = &(poolMgr->gap_ix[poolMgr->pool.num_gaps-1]); 
-				gap = end; // overwrite gap
-				gap->node = NULL;
-				gap->size = 0;
-				poolMgr->pool.num_gaps--;
-				return _mem_sort_gap_ix(poolMgr);
-			} 
-			gap = &(poolMgr->gap_ix[j]);
-			break;
+static alloc_status _add_gap(pool_mgr_pt poolMgr, unsigned node) {
+	const node_heap_pt heap = &poolMgr->node_heap;
+	// range of pool memory that may still be resident and is now free
+	char *releaseLo = _node_record(heap, node)->mem;
+	char *releaseHi = releaseLo + _node_size(heap, node);
+	_set_node_flags(heap, node, NODE_USED);
+//Merge gap below
+	const unsigned below = _node_next(heap, node);
+	if (below != MEM_NO_NODE && _node_flags(heap, below) == NODE_USED) {
+		if (_node_size(heap, below) < MEM_RELEASE_THRESHOLD) {
+			releaseHi += _node_size(heap, below); // never released
 		}
+		_mem_remove_from_gap_ix(poolMgr, _node_size(heap, below), below);
+		_set_node_size(heap, node, _node_size(heap, node) + _node_size(heap, below));
+		_unlink_node(poolMgr, below);
 	}
-	if (gap != NULL) {
+//Merge gap above
+	const unsigned above = _node_prev(heap, node);
+	if (above != MEM_NO_NODE && _node_flags(heap, above) == NODE_USED) {
+		const gap_pt gap = _mem_find_gap(poolMgr, above);
+		if (gap == NULL) return ALLOC_FAIL;
+		if (_node_size(heap, above) < MEM_RELEASE_THRESHOLD) {
+			releaseLo = _node_record(heap, above)->mem; // never released
+		}
+		_mem_resize_gap(poolMgr, above, _node_size(heap, above) + _node_size(heap, node));
+		gap->epoch = (uint32_t) atomic_load_explicit(&scavenger_epoch, memory_order_relaxed);
+		_unlink_node(poolMgr, node);
+		if (!atomic_load_explicit(&scavenger_running, memory_order_relaxed)) {
+			_mem_release_pages(poolMgr, above, releaseLo, releaseHi);
+		}
 		return _mem_sort_gap_ix(poolMgr);
 	}
-//No neighboring gaps for merging
+//No gap above, the node itself becomes a gap
 	//Try to resize gap index
 	if (_mem_resize_gap_ix(poolMgr) != ALLOC_OK)
 	{
@@ -632,32 +1700,1317 @@ static alloc_status _add_gap(pool_mgr_pt poolMgr, node_pt node) {
 //Add gap to back
 	(poolMgr->pool.num_gaps)++;
 	const gap_pt new = &(poolMgr->gap_ix[poolMgr->pool.num_gaps - 1]);
-	new->size =  (node->alloc_record.size);
 	new->node = node;
-	node->allocated = 0;
+	new->epoch = (uint32_t) atomic_load_explicit(&scavenger_epoch, memory_order_relaxed);
+	new->released = 0;
+	_mem_count_gap(poolMgr, _node_size(heap, node), 1);
+	if (!atomic_load_explicit(&scavenger_running, memory_order_relaxed)) {
+		_mem_release_pages(poolMgr, node, releaseLo, releaseHi);
+	}
 
-	//if (gap == NULL) return ALLOC_FAIL;
 	return 	_mem_sort_gap_ix(poolMgr);
-} 
+}
+
+static void _mem_count_gap(pool_mgr_pt poolMgr, size_t size, int delta) {
+	// bucket i holds the gaps of [2^i, 2^(i+1)) bytes; sizes fit in 48 bits
+	const unsigned bucket = size ? 63 - (unsigned) __builtin_clzll((unsigned long long) size) : 0;
+	poolMgr->gap_histogram[bucket] += (unsigned) delta;
+}
+
+static void _mem_resize_gap(pool_mgr_pt poolMgr, unsigned node, size_t size) {
+	// a gap in the index changes size; the caller re-sorts the index
+	_mem_count_gap(poolMgr, _node_size(&poolMgr->node_heap, node), -1);
+	_set_node_size(&poolMgr->node_heap, node, size);
+	_mem_count_gap(poolMgr, size, 1);
+}
+
+static gap_pt _mem_find_gap(pool_mgr_pt poolMgr, unsigned node) {
+	for (unsigned int i = 0; i < poolMgr->pool.num_gaps; i++) {
+		if (poolMgr->gap_ix[i].node == node) {
+			return &(poolMgr->gap_ix[i]);
+		}
+	}
+	return NULL;
+}
+
+static void _unlink_node(pool_mgr_pt poolMgr, unsigned node) {
+	// never called on the head node, which always starts the pool
+	const node_heap_pt heap = &poolMgr->node_heap;
+	const unsigned next = _node_next(heap, node);
+	const unsigned prev = _node_prev(heap, node);
+	_set_node_flags(heap, node, 0);
+	_set_node_size(heap, node, 0);
+	if (prev != MEM_NO_NODE) _set_node_next(heap, prev, next);
+	if (next != MEM_NO_NODE) _set_node_prev(heap, next, prev);
+	// the slot goes on the free list for _add_node to take back
+	_set_node_next(heap, node, poolMgr->free_nodes);
+	_set_node_prev(heap, node, MEM_NO_NODE);
+	if (poolMgr->free_nodes != MEM_NO_NODE) _set_node_prev(heap, poolMgr->free_nodes, node);
+	poolMgr->free_nodes = node;
+	unsigned *live = _chunk_live(heap->chunks[node >> MEM_NODE_CHUNK_SHIFT]);
+	if (--*live == 0 && (node >> MEM_NODE_CHUNK_SHIFT) + 2 >= heap->num_chunks) {
+		_mem_shrink_node_heap(poolMgr);
+	}
+}
+
+static alloc_pt _chunk_records(char *chunk) {
+	return (alloc_pt) chunk;
+}
+
+static uint64_t *_chunk_meta(char *chunk) {
+	return (uint64_t *) (chunk + MEM_NODE_CHUNK_NODES * sizeof(alloc_t));
+}
+
+static uint32_t *_chunk_next(char *chunk) {
+	return (uint32_t *) (chunk + MEM_NODE_CHUNK_NODES * (sizeof(alloc_t) + sizeof(uint64_t)));
+}
+
+static uint32_t *_chunk_prev(char *chunk) {
+	return _chunk_next(chunk) + MEM_NODE_CHUNK_NODES;
+}
+
+static unsigned *_chunk_index(char *chunk) {
+	return (unsigned *) (chunk + MEM_NODE_CHUNK_SIZE);
+}
+
+static unsigned *_chunk_live(char *chunk) {
+	return _chunk_index(chunk) + 1;
+}
+
+static alloc_pt _node_record(const node_heap_t *heap, unsigned node) {
+	return _chunk_records(heap->chunks[node >> MEM_NODE_CHUNK_SHIFT]) + (node & (MEM_NODE_CHUNK_NODES - 1));
+}
 
-static node_pt _convert_gap(pool_mgr_pt poolMgr, gap_pt gap, size_t size) {
-	const node_pt node = gap->node;	
+static unsigned _node_next(const node_heap_t *heap, unsigned node) {
+	return _chunk_next(heap->chunks[node >> MEM_NODE_CHUNK_SHIFT])[node & (MEM_NODE_CHUNK_NODES - 1)];
+}
+
+static unsigned _node_prev(const node_heap_t *heap, unsigned node) {
+	return _chunk_prev(heap->chunks[node >> MEM_NODE_CHUNK_SHIFT])[node & (MEM_NODE_CHUNK_NODES - 1)];
+}
+
+static void _set_node_next(node_heap_pt heap, unsigned node, unsigned next) {
+	_chunk_next(heap->chunks[node >> MEM_NODE_CHUNK_SHIFT])[node & (MEM_NODE_CHUNK_NODES - 1)] = next;
+}
+
+static void _set_node_prev(node_heap_pt heap, unsigned node, unsigned prev) {
+	_chunk_prev(heap->chunks[node >> MEM_NODE_CHUNK_SHIFT])[node & (MEM_NODE_CHUNK_NODES - 1)] = prev;
+}
+
+static size_t _node_size(const node_heap_t *heap, unsigned node) {
+	const uint64_t meta = _chunk_meta(heap->chunks[node >> MEM_NODE_CHUNK_SHIFT])[node & (MEM_NODE_CHUNK_NODES - 1)];
+	return (size_t) (meta & MEM_NODE_SIZE_MASK);
+}
+
+static unsigned _node_flags(const node_heap_t *heap, unsigned node) {
+	const uint64_t meta = _chunk_meta(heap->chunks[node >> MEM_NODE_CHUNK_SHIFT])[node & (MEM_NODE_CHUNK_NODES - 1)];
+	return (unsigned) (meta >> MEM_NODE_FLAGS_SHIFT);
+}
+
+static void _set_node_size(node_heap_pt heap, unsigned node, size_t size) {
+	// the meta column is what the scans read, the record is what the user sees
+	char *chunk = heap->chunks[node >> MEM_NODE_CHUNK_SHIFT];
+	const unsigned slot = node & (MEM_NODE_CHUNK_NODES - 1);
+	uint64_t *meta = _chunk_meta(chunk);
+	meta[slot] = (meta[slot] & ~MEM_NODE_SIZE_MASK) | (uint64_t) size;
+	_chunk_records(chunk)[slot].size = size;
+}
+
+static void _set_node_flags(node_heap_pt heap, unsigned node, unsigned flags) {
+	uint64_t *meta = _chunk_meta(heap->chunks[node >> MEM_NODE_CHUNK_SHIFT]);
+	const unsigned slot = node & (MEM_NODE_CHUNK_NODES - 1);
+	meta[slot] = (meta[slot] & MEM_NODE_SIZE_MASK) | ((uint64_t) flags << MEM_NODE_FLAGS_SHIFT);
+}
+
+static unsigned _mem_last_node(pool_mgr_pt poolMgr) {
+	unsigned last = poolMgr->head;
+	while (_node_next(&poolMgr->node_heap, last) != MEM_NO_NODE) last = _node_next(&poolMgr->node_heap, last);
+	return last;
+}
+
+static size_t _mem_release_pages(pool_mgr_pt poolMgr, unsigned gap, char *lo, char *hi) {
+	// give back the whole pages of a large gap that were freed just now;
+	// MADV_DONTNEED rather than MADV_FREE, so that RSS drops right away
+	const size_t size = _node_size(&poolMgr->node_heap, gap);
+	char *mem = _node_record(&poolMgr->node_heap, gap)->mem;
+	if (size < MEM_RELEASE_THRESHOLD) return 0;
+	const size_t page = poolMgr->page_size;
+	char *start = (char *) (((size_t) mem + page - 1) & ~(page - 1));
+	char *end = (char *) ((size_t) (mem + size) & ~(page - 1));
+	char *lower = (char *) ((size_t) lo & ~(page - 1));
+	char *upper = (char *) (((size_t) hi + page - 1) & ~(page - 1));
+	if (lower > start) start = lower;
+	if (upper < end) end = upper;
+	if (end > start && madvise(start, (size_t) (end - start), MADV_DONTNEED) == 0) {
+		return (size_t) (end - start);
+	}
+	return 0;
+}
+
+static void *_mem_scavenger_main(void *arg) {
+	(void) arg;
+	pthread_mutex_lock(&scavenger_lock);
+	while (!scavenger_stopping) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += scavenger_options.interval_ms / 1000;
+		deadline.tv_nsec += (long) (scavenger_options.interval_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while (!scavenger_stopping
+		       && pthread_cond_timedwait(&scavenger_wake, &scavenger_lock, &deadline) != ETIMEDOUT);
+		if (scavenger_stopping) break;
+		pthread_mutex_unlock(&scavenger_lock);
+		_mem_scavenge_pass();
+		pthread_mutex_lock(&scavenger_lock);
+	}
+	pthread_mutex_unlock(&scavenger_lock);
+	return NULL;
+}
+
+static void _mem_scavenge_pass() {
+	// release idle gaps, largest first, until the per-pass budget runs out;
+	// a gap remembers how far it got, so big gaps go back over several passes
+	const unsigned long epoch = atomic_fetch_add(&scavenger_epoch, 1) + 1;
+	const unsigned long idleEpochs = (scavenger_options.idle_ms + scavenger_options.interval_ms - 1)
+	                                 / scavenger_options.interval_ms;
+	size_t budget = scavenger_options.max_bytes_per_pass ? scavenger_options.max_bytes_per_pass : SIZE_MAX;
+	unsigned long gapsReleased = 0;
+	size_t bytesReleased = 0;
+	int throttled = 0;
+
+	pthread_mutex_lock(&pool_store_lock);
+	for (unsigned int p = 0; p < pool_store_size && !throttled; p++) {
+		const pool_mgr_pt poolMgr = pool_store[p];
+		if (poolMgr == NULL) continue;
+		pthread_mutex_lock(&poolMgr->lock);
+		const size_t page = poolMgr->page_size;
+		for (unsigned int i = poolMgr->pool.num_gaps; i-- > 0; ) {
+			const gap_pt gap = &(poolMgr->gap_ix[i]);
+			const size_t size = _node_size(&poolMgr->node_heap, gap->node);
+			const size_t released = (size_t) gap->released * page;
+			if (size < MEM_RELEASE_THRESHOLD) break; // sorted, the rest are smaller
+			if (released >= size || (uint32_t) (epoch - gap->epoch) < idleEpochs) continue;
+			if (budget == 0) {
+				throttled = 1;
+				break;
+			}
+			size_t chunk = size - released;
+			if (chunk > budget) {
+				chunk = budget;
+				throttled = 1;
+			}
+			char *lo = _node_record(&poolMgr->node_heap, gap->node)->mem + released;
+			bytesReleased += _mem_release_pages(poolMgr, gap->node, lo, lo + chunk);
+			gap->released = (uint32_t) ((released + chunk + page - 1) / page);
+			budget -= chunk;
+			if (released + chunk >= size) gapsReleased++;
+		}
+		pthread_mutex_unlock(&poolMgr->lock);
+	}
+	pthread_mutex_unlock(&pool_store_lock);
+
+	pthread_mutex_lock(&scavenger_lock);
+	scavenger_stats.passes++;
+	scavenger_stats.throttled_passes += (unsigned long) throttled;
+	scavenger_stats.gaps_released += gapsReleased;
+	scavenger_stats.bytes_released += bytesReleased;
+	pthread_mutex_unlock(&scavenger_lock);
+}
+
+static unsigned _convert_gap(pool_mgr_pt poolMgr, gap_pt gap, size_t size) {
+	const node_heap_pt heap = &poolMgr->node_heap;
+	const unsigned node = gap->node;
+	const size_t gapSize = _node_size(heap, node);
 	//node fits in gap
-	if ( (gap->size) ==  (size)) {
-		node->allocated = 1;
+	if ( (gapSize) ==  (size)) {
+		_set_node_flags(heap, node, NODE_USED | NODE_ALLOCATED);
 		_mem_remove_from_gap_ix(poolMgr,  (size), node);
 		return node;
 	}
-	node->allocated = 1;
-	node->used = 1;
-	node->alloc_record.size =  (size);
-	gap->node = _add_node(poolMgr, node);
-	size_t newSize = (gap->size - size);
-	gap->node->alloc_record.size = newSize;
-	gap->size = newSize;
-
-	gap->node->alloc_record.mem = (char*) ((node->alloc_record.mem) + size);
-	gap->node->allocated = 0;
-	gap->node->used = 1;
+	const unsigned rest = _add_node(poolMgr, node);
+	if (rest == MEM_NO_NODE) return MEM_NO_NODE;
+	_set_node_flags(heap, node, NODE_USED | NODE_ALLOCATED);
+	_set_node_size(heap, node, size);
+	gap->node = rest;
+	_set_node_size(heap, rest, gapSize - size);
+	_mem_count_gap(poolMgr, gapSize, -1);
+	_mem_count_gap(poolMgr, gapSize - size, 1);
+	const uint32_t used = (uint32_t) ((size + poolMgr->page_size - 1) / poolMgr->page_size);
+	gap->released = gap->released > used ? gap->released - used : 0;
+
+	_node_record(heap, rest)->mem = (char*) ((_node_record(heap, node)->mem) + size);
+	_set_node_flags(heap, rest, NODE_USED);
+	_mem_sort_gap_ix(poolMgr); // the remaining gap shrank
+	return node;
+}
+
+static alloc_status _mem_trim(pool_mgr_pt poolMgr, size_t keep_bytes) {
+	// the body of mem_pool_trim, called with the pool locked
+	const node_heap_pt heap = &poolMgr->node_heap;
+	_mem_quick_flush(poolMgr);
+	const unsigned last = _mem_last_node(poolMgr);
+	// a sub-pool's region is one allocation of its parent, and stays whole
+	if (poolMgr->backing != BACKING_PARENT
+	    && _node_flags(heap, last) == NODE_USED && _node_size(heap, last) > keep_bytes) {
+		const size_t page = poolMgr->page_size;
+		const size_t oldTotal = poolMgr->pool.total_size;
+		const size_t wanted = oldTotal - (_node_size(heap, last) - keep_bytes);
+		size_t mapped = (wanted + page - 1) & ~(page - 1);
+		if (mapped == 0) mapped = page; // an empty pool keeps its head segment
+		if (mapped < poolMgr->mapped_size) {
+			char *tail = poolMgr->pool.mem + mapped;
+			const size_t tailSize = poolMgr->mapped_size - mapped;
+			if (poolMgr->flags & POOL_GROWABLE) {
+				// decommit, but keep the reservation for later growth
+				if (mprotect(tail, tailSize, PROT_NONE) != 0) return ALLOC_FAIL;
+				madvise(tail, tailSize, MADV_DONTNEED);
+			} else {
+				_mem_map_range(tail, tailSize, NULL);
+				if (munmap(tail, tailSize) != 0) return ALLOC_FAIL;
+				poolMgr->reserved_size = mapped;
+			}
+			poolMgr->mapped_size = mapped;
+		}
+		const size_t newTotal = mapped < oldTotal ? mapped : oldTotal;
+		if (newTotal < oldTotal) {
+			poolMgr->pool.total_size = newTotal;
+			_mem_resize_gap(poolMgr, last, _node_size(heap, last) - (oldTotal - newTotal));
+			if (_node_size(heap, last) == 0) {
+				_mem_remove_from_gap_ix(poolMgr, 0, last);
+				_unlink_node(poolMgr, last);
+			} else {
+				_mem_sort_gap_ix(poolMgr);
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < poolMgr->pool.num_gaps; i++) {
+		const unsigned gap = poolMgr->gap_ix[i].node;
+		const size_t size = _node_size(heap, gap);
+		_mem_release_pages(poolMgr, gap, _node_record(heap, gap)->mem, _node_record(heap, gap)->mem + size);
+		poolMgr->gap_ix[i].released = (uint32_t) ((size + poolMgr->page_size - 1) / poolMgr->page_size);
+	}
+	return ALLOC_OK;
+}
+
+static int _mem_quick_push(pool_mgr_pt poolMgr, unsigned node) {
+	// park a freed block in the bin for its exact size, without coalescing;
+	// the bin link lives in the block itself. Returns 0 if it doesn't qualify.
+	const node_heap_pt heap = &poolMgr->node_heap;
+	const size_t size = _node_size(heap, node);
+	if (poolMgr->quick_bins == NULL || size < MEM_QUICK_BIN_MIN || size > MEM_QUICK_BIN_MAX) return 0;
+	memcpy(_node_record(heap, node)->mem, &(poolMgr->quick_bins[size]), sizeof(uint32_t));
+	poolMgr->quick_bins[size] = node;
+	_set_node_flags(heap, node, NODE_USED | NODE_BINNED);
+	poolMgr->binned_bytes += size;
+	if (poolMgr->binned_bytes > MEM_QUICK_BIN_LIMIT) _mem_quick_flush(poolMgr);
+	return 1;
+}
+
+static unsigned _mem_quick_pop(pool_mgr_pt poolMgr, size_t size) {
+	const node_heap_pt heap = &poolMgr->node_heap;
+	if (poolMgr->quick_bins == NULL || size < MEM_QUICK_BIN_MIN || size > MEM_QUICK_BIN_MAX) return MEM_NO_NODE;
+	const unsigned node = poolMgr->quick_bins[size];
+	if (node == MEM_NO_NODE) return MEM_NO_NODE;
+	memcpy(&(poolMgr->quick_bins[size]), _node_record(heap, node)->mem, sizeof(uint32_t));
+	_set_node_flags(heap, node, NODE_USED | NODE_ALLOCATED);
+	poolMgr->binned_bytes -= size;
 	return node;
 }
+
+static void _mem_quick_flush(pool_mgr_pt poolMgr) {
+	// coalesce every binned block into the gap index, the deferred half of
+	// mem_del_alloc; the link is read before the block can merge away
+	if (poolMgr->binned_bytes == 0) return;
+	for (size_t size = MEM_QUICK_BIN_MIN; size <= MEM_QUICK_BIN_MAX; size++) {
+		unsigned node = poolMgr->quick_bins[size];
+		while (node != MEM_NO_NODE) {
+			unsigned next;
+			memcpy(&next, _node_record(&poolMgr->node_heap, node)->mem, sizeof(uint32_t));
+			_mem_add_to_gap_ix(poolMgr, size, node);
+			node = next;
+		}
+		poolMgr->quick_bins[size] = MEM_NO_NODE;
+	}
+	poolMgr->binned_bytes = 0;
+}
+
+static alloc_status _mem_quick_enable(pool_mgr_pt poolMgr) {
+	poolMgr->quick_bins = (uint32_t *) malloc((MEM_QUICK_BIN_MAX + 1) * sizeof(uint32_t));
+	if (poolMgr->quick_bins == NULL) {
+		poolMgr->flags &= ~POOL_QUICK_BINS;
+		return ALLOC_FAIL;
+	}
+	memset(poolMgr->quick_bins, 0xFF, (MEM_QUICK_BIN_MAX + 1) * sizeof(uint32_t));
+	poolMgr->flags |= POOL_QUICK_BINS;
+	return ALLOC_OK;
+}
+
+static void _mem_quick_disable(pool_mgr_pt poolMgr) {
+	_mem_quick_flush(poolMgr);
+	free(poolMgr->quick_bins);
+	poolMgr->quick_bins = NULL;
+	poolMgr->flags &= ~POOL_QUICK_BINS;
+}
+
+static void _mem_auto_alloc(pool_mgr_pt poolMgr, size_t size, alloc_pt alloc) {
+	// sample an allocation, and choose again once the window is full
+	auto_fit_t *autoFit = &poolMgr->auto_fit;
+	const unsigned ring = sizeof(autoFit->recent) / sizeof(autoFit->recent[0]);
+	autoFit->allocs++;
+	if (size <= MEM_QUICK_BIN_MAX) autoFit->small++;
+	if (alloc != NULL) {
+		autoFit->recent[autoFit->next_recent] = alloc->mem;
+		autoFit->next_recent = (autoFit->next_recent + 1) % ring;
+	}
+	if (autoFit->allocs >= MEM_AUTO_WINDOW) _mem_auto_adapt(poolMgr);
+}
+
+static void _mem_auto_free(pool_mgr_pt poolMgr, alloc_pt alloc) {
+	auto_fit_t *autoFit = &poolMgr->auto_fit;
+	const unsigned ring = sizeof(autoFit->recent) / sizeof(autoFit->recent[0]);
+	autoFit->frees++;
+	for (unsigned int r = 0; r < ring; r++) {
+		if (autoFit->recent[r] == alloc->mem) {
+			autoFit->short_lived++;
+			autoFit->recent[r] = NULL;
+			break;
+		}
+	}
+}
+
+static void _mem_auto_adapt(pool_mgr_pt poolMgr) {
+	// at the end of a window, under the lock and between allocations, so
+	// no scan is under way and no block is half binned:
+	//   FIRST_FIT to BEST_FIT when the gaps get fragmented, or when the
+	//   first-fit scans walk a good part of the nodes anyway, since the
+	//   best-fit sweep of all of them is vectorized
+	//   back to FIRST_FIT when the fragmentation is gone, and the list
+	//   has halved if long scans were the reason
+	//   quick bins, the segregated fit, while most requests are small and
+	//   most frees are of blocks allocated a moment ago; not if the pool
+	//   was opened with them, then they stay, and never for a pool file
+	auto_fit_t *autoFit = &poolMgr->auto_fit;
+	const size_t freeBytes = poolMgr->pool.total_size - (poolMgr->pool.alloc_size - poolMgr->large_bytes)
+	                         - poolMgr->binned_bytes;
+	const size_t largestGap = poolMgr->pool.num_gaps ?
+	                          _node_size(&poolMgr->node_heap, poolMgr->gap_ix[poolMgr->pool.num_gaps - 1].node) : 0;
+	const float fragmentation = freeBytes ? 1.0f - (float) largestGap / (float) freeBytes : 0.0f;
+	// a first-fit scan walks the list of live nodes
+	const unsigned listNodes = poolMgr->pool.num_allocs + poolMgr->pool.num_gaps;
+
+	if (autoFit->fit == FIRST_FIT) {
+		const int longScans = listNodes >= MEM_AUTO_MIN_NODES && autoFit->scans
+		                      && autoFit->steps / autoFit->scans > listNodes / MEM_AUTO_LONG_SCAN;
+		if (fragmentation > MEM_AUTO_FRAG_HIGH || longScans) {
+			autoFit->fit = BEST_FIT;
+			autoFit->long_scan_nodes = longScans ? listNodes : 0;
+		}
+	} else if (fragmentation < MEM_AUTO_FRAG_LOW
+	           && (autoFit->long_scan_nodes == 0 || listNodes < autoFit->long_scan_nodes / 2)) {
+		autoFit->fit = FIRST_FIT;
+		autoFit->long_scan_nodes = 0;
+	}
+
+	const int small = autoFit->small * 4 >= autoFit->allocs * 3;
+	if (poolMgr->quick_bins == NULL) {
+		if (small && autoFit->short_lived * 2 >= autoFit->frees && autoFit->frees
+		    && poolMgr->backing != BACKING_FILE
+		    && _mem_quick_enable(poolMgr) == ALLOC_OK) {
+			autoFit->bins = 1;
+		}
+	} else if (autoFit->bins && (!small || autoFit->short_lived * 8 < autoFit->frees)) {
+		_mem_quick_disable(poolMgr);
+		autoFit->bins = 0;
+	}
+
+	autoFit->allocs = autoFit->small = autoFit->frees = autoFit->short_lived = autoFit->scans = 0;
+	autoFit->steps = 0;
+}
+
+static size_t _mem_slide(pool_mgr_pt poolMgr, unsigned gap, unsigned node) {
+	// move the allocation at node down to the start of the gap just before
+	// it, and the gap up behind it, merging it with a gap that follows
+	const node_heap_pt heap = &poolMgr->node_heap;
+	const alloc_pt record = _node_record(heap, node);
+	const size_t size = _node_size(heap, node);
+	char *mem = _node_record(heap, gap)->mem;
+	memmove(mem, record->mem, size);
+	record->mem = mem;
+	_node_record(heap, gap)->mem = mem + size;
+
+	// relink as prev <-> node <-> gap <-> next
+	const unsigned prev = _node_prev(heap, gap);
+	const unsigned next = _node_next(heap, node);
+	_set_node_prev(heap, node, prev);
+	_set_node_next(heap, node, gap);
+	_set_node_prev(heap, gap, node);
+	_set_node_next(heap, gap, next);
+	if (prev != MEM_NO_NODE) {
+		_set_node_next(heap, prev, node);
+	} else {
+		poolMgr->head = node;
+	}
+	if (next != MEM_NO_NODE) _set_node_prev(heap, next, gap);
+
+	if (next != MEM_NO_NODE && _node_flags(heap, next) == NODE_USED) {
+		_mem_remove_from_gap_ix(poolMgr, _node_size(heap, next), next);
+		_mem_resize_gap(poolMgr, gap, _node_size(heap, gap) + _node_size(heap, next));
+		_unlink_node(poolMgr, next);
+		_mem_sort_gap_ix(poolMgr);
+	}
+	const gap_pt entry = _mem_find_gap(poolMgr, gap);
+	if (entry != NULL) {
+		entry->epoch = (uint32_t) atomic_load_explicit(&scavenger_epoch, memory_order_relaxed);
+		entry->released = 0;
+	}
+	return size;
+}
+
+static unsigned _mem_new_node(pool_mgr_pt poolMgr, size_t size) {
+    // mem_new_alloc for a node, under the lock and without the accounting
+    // a block of this very size freed a moment ago comes straight back
+	const unsigned quick = _mem_quick_pop(poolMgr, size);
+	if (quick != MEM_NO_NODE) return quick;
+    // check if any gaps, return null if none
+	if (poolMgr->pool.num_gaps < 1 && poolMgr->binned_bytes == 0 && !(poolMgr->flags & POOL_GROWABLE)) {
+		return MEM_NO_NODE;
+	}
+    // expand heap node, if necessary, quit on error
+    // (done by _add_node, one chunk at a time)
+    // check used nodes fewer than total nodes, quit on error
+	if (poolMgr->total_nodes < poolMgr->used_nodes) {
+		return MEM_NO_NODE;
+	}
+    // get a node for allocation
+    // if FIRST_FIT, then find the first sufficient node in the node heap
+    // if BEST_FIT, then find the first sufficient node in the gap index
+    // check if node found
+    // calculate the size of the remaining gap, if any
+    // remove node from gap index
+    // convert gap_node to an allocation node of given size
+    // adjust node heap:
+    //   if remaining gap, need a new node
+    //   find an unused one in the node heap
+    //   make sure one was found
+    //   initialize it to a gap node
+    //   update metadata (used_nodes)
+    //   update linked list (new node right after the node for allocation)
+    //   add to gap index
+    //   check if successful
+	
+	unsigned new = MEM_NO_NODE;
+	unsigned best = _mem_find_fit(poolMgr, size);
+	if (best == MEM_NO_NODE && poolMgr->binned_bytes) {
+		// a miss, the binned blocks may coalesce into a gap that fits
+		_mem_quick_flush(poolMgr);
+		best = _mem_find_fit(poolMgr, size);
+	}
+	if (best == MEM_NO_NODE && (poolMgr->flags & POOL_GROWABLE)) {
+		// commit more of the reserved range and try again
+		if (_mem_grow_pool(poolMgr, size) == ALLOC_OK) {
+			best = _mem_find_fit(poolMgr, size);
+		}
+	}
+	if (best != MEM_NO_NODE) {
+		const gap_pt gap = _mem_find_gap(poolMgr, best);
+		if (gap != NULL) new = _convert_gap(poolMgr, gap, (size));
+	}
+	return new;
+}
+
+static alloc_pt _mem_small_alloc(pool_mgr_pt poolMgr, size_t size) {
+	// the lowest free slot of the first slab of the size class with one,
+	// carving a new slab if none has; NULL if the pool can't host one
+	const unsigned cls = (unsigned) ((size - 1) / MEM_SMALL_GRANULE);
+	small_slab_pt slab = poolMgr->small_partial[cls];
+	if (slab == NULL) {
+		slab = _mem_small_add_slab(poolMgr, (cls + 1) * MEM_SMALL_GRANULE);
+		if (slab == NULL) return NULL;
+		poolMgr->small_partial[cls] = slab;
+	}
+	const unsigned word = slab->free_map[0] ? 0 : 1;
+	const unsigned slot = word * 64 + (unsigned) __builtin_ctzll(slab->free_map[word]);
+	slab->free_map[word] &= slab->free_map[word] - 1;
+	if (--slab->num_free == 0) poolMgr->small_partial[cls] = slab->next_partial;
+	const alloc_pt record = &slab->records[slot];
+	record->size = size;
+	record->mem = slab->mem + (size_t) slot * slab->slot_size;
+	return record;
+}
+
+static alloc_status _mem_small_free(pool_mgr_pt poolMgr, small_slab_pt slab, alloc_pt alloc) {
+	const unsigned slot = (unsigned) (alloc - slab->records);
+	const uint64_t bit = 1ull << (slot & 63);
+	if (slab->free_map[slot >> 6] & bit) return ALLOC_FAIL; // freed already
+	slab->free_map[slot >> 6] |= bit;
+	const unsigned cls = (unsigned) (slab->slot_size / MEM_SMALL_GRANULE - 1);
+	if (++slab->num_free == 1) {
+		// was full, has a slot again
+		slab->next_partial = poolMgr->small_partial[cls];
+		poolMgr->small_partial[cls] = slab;
+	} else if (slab->num_free == MEM_SMALL_SLAB_SLOTS
+	           && (poolMgr->small_partial[cls] != slab || slab->next_partial != NULL)) {
+		// empty, and not the last slab of its class, which stays for reuse
+		_mem_small_release_slab(poolMgr, slab);
+	}
+	return ALLOC_OK;
+}
+
+static small_slab_pt _mem_small_add_slab(pool_mgr_pt poolMgr, size_t slot_size) {
+	if (poolMgr->num_small_slabs == poolMgr->small_slabs_capacity) {
+		const unsigned capacity = poolMgr->small_slabs_capacity
+		                          ? poolMgr->small_slabs_capacity * MEM_SMALL_DIR_EXPAND_FACTOR
+		                          : MEM_SMALL_DIR_INIT_CAPACITY;
+		small_slab_pt *slabs = (small_slab_pt *) realloc(poolMgr->small_slabs, capacity * sizeof(small_slab_pt));
+		if (slabs == NULL) return NULL;
+		poolMgr->small_slabs = slabs;
+		poolMgr->small_slabs_capacity = capacity;
+	}
+	void *side = NULL;
+	if (posix_memalign(&side, MEM_SMALL_SLAB_SIZE, MEM_SMALL_SLAB_SIZE) != 0) return NULL;
+	const unsigned node = _mem_new_node(poolMgr, MEM_SMALL_SLAB_SLOTS * slot_size);
+	if (node == MEM_NO_NODE) {
+		free(side);
+		return NULL;
+	}
+	const small_slab_pt slab = (small_slab_pt) side;
+	slab->index = poolMgr->num_small_slabs;
+	slab->node = node;
+	slab->num_free = MEM_SMALL_SLAB_SLOTS;
+	slab->slot_size = (unsigned) slot_size;
+	slab->mem = _node_record(&poolMgr->node_heap, node)->mem;
+	slab->free_map[0] = ~0ull;
+	slab->free_map[1] = (1ull << (MEM_SMALL_SLAB_SLOTS - 64)) - 1;
+	slab->next_partial = NULL;
+	poolMgr->small_slabs[poolMgr->num_small_slabs++] = slab;
+	return slab;
+}
+
+static void _mem_small_release_slab(pool_mgr_pt poolMgr, small_slab_pt slab) {
+	// give an empty slab's node back to the pool and drop the slab
+	const unsigned cls = (unsigned) (slab->slot_size / MEM_SMALL_GRANULE - 1);
+	small_slab_pt *link = &poolMgr->small_partial[cls];
+	while (*link != NULL && *link != slab) link = &(*link)->next_partial;
+	if (*link != NULL) *link = slab->next_partial;
+	_mem_add_to_gap_ix(poolMgr, _node_size(&poolMgr->node_heap, slab->node), slab->node);
+	const small_slab_pt last = poolMgr->small_slabs[--poolMgr->num_small_slabs];
+	poolMgr->small_slabs[slab->index] = last;
+	last->index = slab->index;
+	free(slab);
+}
+
+static small_slab_pt _mem_small_slab_of(pool_mgr_pt poolMgr, const alloc_t *alloc) {
+	// the slab a record was handed out from, NULL for a node record: those
+	// sit in node chunks, whose masked address never names a slab in use
+	if (poolMgr->num_small_slabs == 0) return NULL;
+	const small_slab_pt slab = (small_slab_pt) ((uintptr_t) alloc & ~(uintptr_t) (MEM_SMALL_SLAB_SIZE - 1));
+	if (slab->index >= poolMgr->num_small_slabs || poolMgr->small_slabs[slab->index] != slab) return NULL;
+	return (alloc >= slab->records && alloc < slab->records + MEM_SMALL_SLAB_SLOTS) ? slab : NULL;
+}
+
+static alloc_pt _mem_large_alloc(pool_mgr_pt poolMgr, size_t size) {
+	// map first, the lock is only needed to enter it in the side table
+	const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	if (size > SIZE_MAX - page) return NULL;
+	const size_t mapped = (size + page - 1) & ~(page - 1);
+	const large_alloc_pt entry = (large_alloc_pt) malloc(sizeof(large_alloc_t));
+	if (entry == NULL) return NULL;
+	void *mem = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		free(entry);
+		return NULL;
+	}
+	entry->record.size = size;
+	entry->record.mem = (char *) mem;
+	entry->mapped_size = mapped;
+	if (_mem_map_range(entry->record.mem, mapped, poolMgr) != ALLOC_OK) {
+		munmap(mem, mapped);
+		free(entry);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&poolMgr->lock);
+	if (poolMgr->num_large_allocs == poolMgr->large_allocs_capacity) {
+		const unsigned capacity = poolMgr->large_allocs_capacity
+		                          ? poolMgr->large_allocs_capacity * MEM_LARGE_TABLE_EXPAND_FACTOR
+		                          : MEM_LARGE_TABLE_INIT_CAPACITY;
+		large_alloc_pt *table = (large_alloc_pt *) realloc(poolMgr->large_allocs, capacity * sizeof(large_alloc_pt));
+		if (table == NULL) {
+			pthread_mutex_unlock(&poolMgr->lock);
+			_mem_map_range(entry->record.mem, mapped, NULL);
+			munmap(mem, mapped);
+			free(entry);
+			return NULL;
+		}
+		poolMgr->large_allocs = table;
+		poolMgr->large_allocs_capacity = capacity;
+	}
+	poolMgr->large_allocs[poolMgr->num_large_allocs++] = entry;
+	poolMgr->pool.num_allocs++;
+	poolMgr->pool.alloc_size += size;
+	poolMgr->large_bytes += size;
+	pthread_mutex_unlock(&poolMgr->lock);
+	return &entry->record;
+}
+
+static unsigned _mem_large_find(pool_mgr_pt poolMgr, const alloc_t *alloc) {
+	// position in the side table, MEM_NO_NODE if it isn't a large one;
+	// each is above the threshold, so there are never many of them
+	for (unsigned int l = 0; l < poolMgr->num_large_allocs; l++) {
+		if (&poolMgr->large_allocs[l]->record == alloc) return l;
+	}
+	return MEM_NO_NODE;
+}
+
+static alloc_status _mem_map_pool(pool_mgr_pt poolMgr, const pool_options_t *options) {
+	const size_t size = poolMgr->pool.total_size;
+	unsigned flags = options ? options->flags : 0;
+	char *mem = MAP_FAILED;
+
+	if (flags & POOL_GROWABLE) {
+		// reserve the address range up front, commit only what's needed now
+		flags &= ~POOL_HUGE_PAGES;
+		const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+		size_t reserve = options->reserve_size > size ? options->reserve_size : size;
+		reserve = (reserve + page - 1) & ~(page - 1);
+		mem = (char *) mmap(NULL, reserve, PROT_NONE,
+		                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (mem == MAP_FAILED) return ALLOC_FAIL;
+		const size_t committed = (size + page - 1) & ~(page - 1);
+		if (committed > 0 && mprotect(mem, committed, PROT_READ | PROT_WRITE) != 0) {
+			munmap(mem, reserve);
+			return ALLOC_FAIL;
+		}
+		poolMgr->pool.mem = mem;
+		poolMgr->page_size = page;
+		poolMgr->mapped_size = committed;
+		poolMgr->reserved_size = reserve;
+		poolMgr->flags = flags;
+		return ALLOC_OK;
+	}
+
+	if (flags & POOL_HUGE_PAGES) {
+		const size_t huge = MEM_HUGE_PAGE_SIZE;
+		const size_t length = (size + huge - 1) & ~(huge - 1);
+		// reserved hugetlbfs pages, if the system has any
+		mem = (char *) mmap(NULL, length, PROT_READ | PROT_WRITE,
+		                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (mem == MAP_FAILED) {
+			// otherwise transparent huge pages on a 2 MB aligned mapping
+			char *raw = (char *) mmap(NULL, length + huge, PROT_READ | PROT_WRITE,
+			                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (raw != MAP_FAILED) {
+				mem = (char *) (((uintptr_t) raw + huge - 1) & ~(uintptr_t) (huge - 1));
+				if (mem > raw) munmap(raw, (size_t) (mem - raw));
+				if (raw + huge > mem) munmap(mem + length, (size_t) (raw + huge - mem));
+				if (madvise(mem, length, MADV_HUGEPAGE) != 0) {
+					flags &= ~POOL_HUGE_PAGES; // no THP, keep normal pages
+				}
+			}
+		}
+		if (mem != MAP_FAILED) {
+			poolMgr->pool.mem = mem;
+			poolMgr->mapped_size = length;
+			poolMgr->reserved_size = length;
+			poolMgr->page_size = (flags & POOL_HUGE_PAGES) ? huge : (size_t) sysconf(_SC_PAGESIZE);
+			poolMgr->flags = flags;
+			return ALLOC_OK;
+		}
+		flags &= ~POOL_HUGE_PAGES;
+	}
+
+	poolMgr->page_size = (size_t) sysconf(_SC_PAGESIZE);
+	poolMgr->mapped_size = (size + poolMgr->page_size - 1) & ~(poolMgr->page_size - 1);
+	mem = (char *) mmap(NULL, poolMgr->mapped_size, PROT_READ | PROT_WRITE,
+	                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) return ALLOC_FAIL;
+	poolMgr->pool.mem = mem;
+	poolMgr->reserved_size = poolMgr->mapped_size;
+	poolMgr->flags = flags;
+	return ALLOC_OK;
+}
+
+static unsigned _mem_numa_online(numa_mask_t *mask) {
+	// parse a node list like "0-3,6"; a machine without the sysfs file has one node
+	memset(mask, 0, sizeof(*mask));
+	const unsigned maxNodes = 8 * sizeof(mask->bits);
+	const unsigned wordBits = 8 * sizeof(unsigned long);
+	char list[256];
+	unsigned highest = 0;
+	FILE *file = fopen(MEM_NUMA_ONLINE_PATH, "r");
+	if (file == NULL || fgets(list, sizeof(list), file) == NULL) {
+		if (file) fclose(file);
+		mask->bits[0] = 1;
+		return 1;
+	}
+	fclose(file);
+	char *cursor = list;
+	while (*cursor >= '0' && *cursor <= '9') {
+		unsigned long first = strtoul(cursor, &cursor, 10);
+		unsigned long last = first;
+		if (*cursor == '-') last = strtoul(cursor + 1, &cursor, 10);
+		for (unsigned long n = first; n <= last && n < maxNodes; n++) {
+			mask->bits[n / wordBits] |= 1UL << (n % wordBits);
+			if (n + 1 > highest) highest = (unsigned) n + 1;
+		}
+		if (*cursor == ',') cursor++;
+	}
+	if (highest == 0) {
+		mask->bits[0] = 1;
+		highest = 1;
+	}
+	return highest;
+}
+
+static void _mem_numa_place(pool_mgr_pt poolMgr, const pool_options_t *options) {
+	// best effort: a single node, an unknown node or a kernel without
+	// mbind leaves the pages wherever first touch puts them
+	const unsigned wanted = options ? options->flags & (POOL_NUMA_BIND | POOL_NUMA_INTERLEAVE) : 0;
+	poolMgr->flags &= ~(POOL_NUMA_BIND | POOL_NUMA_INTERLEAVE);
+	if (wanted == 0) return;
+	numa_mask_t online, mask;
+	const unsigned nodes = _mem_numa_online(&online);
+	const unsigned wordBits = 8 * sizeof(unsigned long);
+	int mode = MEM_MPOL_INTERLEAVE;
+	if (wanted & POOL_NUMA_BIND) {
+		const unsigned node = (unsigned) options->numa_node;
+		if (options->numa_node < 0 || node >= nodes) return;
+		memset(&mask, 0, sizeof(mask));
+		mask.bits[node / wordBits] = 1UL << (node % wordBits);
+		mode = MEM_MPOL_BIND;
+	} else {
+		mask = online;
+	}
+	if (nodes < 2) return;
+	// maxnode counts one past the last bit the kernel reads
+	if (syscall(SYS_mbind, poolMgr->pool.mem, poolMgr->reserved_size, mode,
+	            mask.bits, (unsigned long) (8 * sizeof(mask.bits) + 1), 0UL) == 0) {
+		poolMgr->flags |= (mode == MEM_MPOL_BIND) ? POOL_NUMA_BIND : POOL_NUMA_INTERLEAVE;
+	}
+}
+static void _mem_prefault(char *mem, size_t size) {
+	// fault fresh pool pages in now rather than on first use; one call on
+	// kernels that can populate a range, a write to every page otherwise.
+	// MAP_POPULATE would fault them in before _mem_numa_place binds them
+	if (size == 0 || madvise(mem, size, MEM_MADV_POPULATE_WRITE) == 0) return;
+	const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	for (size_t offset = 0; offset < size; offset += page) {
+		((volatile char *) mem)[offset] = 0;
+	}
+}
+
+static unsigned _mem_find_fit(pool_mgr_pt poolMgr, size_t size) {
+    // if FIRST_FIT, then find the first sufficient node in the node heap
+    // if BEST_FIT, then find the smallest sufficient node in the node heap
+    // note: only the meta and next columns are read; a gap of at least
+    // size is a meta word in [want, want + span), a single unsigned compare
+	const node_heap_pt heap = &poolMgr->node_heap;
+	const uint64_t want = ((uint64_t) NODE_USED << MEM_NODE_FLAGS_SHIFT) | (uint64_t) size;
+	const uint64_t span = ((uint64_t) 1 << MEM_NODE_FLAGS_SHIFT) - (uint64_t) size;
+	const alloc_policy policy = poolMgr->pool.policy == AUTO_FIT ? poolMgr->auto_fit.fit : poolMgr->pool.policy;
+	unsigned best = MEM_NO_NODE;
+	unsigned current = poolMgr->head;
+	if (size > MEM_NODE_SIZE_MASK) return MEM_NO_NODE;
+	if (policy == FIRST_FIT) {
+		// links mostly stay within a chunk, so keep the chunk at hand
+		// rather than going through the directory on every step
+		unsigned base = current & ~(MEM_NODE_CHUNK_NODES - 1);
+		const uint64_t *meta = _chunk_meta(heap->chunks[current >> MEM_NODE_CHUNK_SHIFT]);
+		const uint32_t *next = _chunk_next(heap->chunks[current >> MEM_NODE_CHUNK_SHIFT]);
+		unsigned long steps = 0;
+		while (current != MEM_NO_NODE) {
+			if (current - base >= MEM_NODE_CHUNK_NODES) {
+				char *chunk = heap->chunks[current >> MEM_NODE_CHUNK_SHIFT];
+				base = current & ~(MEM_NODE_CHUNK_NODES - 1);
+				meta = _chunk_meta(chunk);
+				next = _chunk_next(chunk);
+			}
+			if (meta[current - base] - want < span) {
+				best = current;
+				break;
+			}
+			current = next[current - base];
+			steps++;
+		}
+		if (poolMgr->pool.policy == AUTO_FIT) {
+			poolMgr->auto_fit.scans++;
+			poolMgr->auto_fit.steps += steps;
+		}
+	}
+
+	if (policy == BEST_FIT) {
+		// every gap is a candidate, so sweep the meta column chunk by chunk
+		// instead of chasing links, a vector compare at a time; only the
+		// slots that fit are looked at again. Ties go to the lowest address
+		const fit_scan_fn scan = (fit_scan == NULL || (poolMgr->flags & POOL_SCALAR_SCAN))
+		                         ? _mem_fit_scan_scalar : fit_scan;
+		uint64_t bestMeta = 0;
+		char *bestMem = NULL;
+		for (unsigned int c = 0; (c << MEM_NODE_CHUNK_SHIFT) < poolMgr->used_nodes; c++) {
+			char *chunk = heap->chunks[c];
+			const uint64_t *meta = _chunk_meta(chunk);
+			uint64_t mask[MEM_NODE_CHUNK_NODES / 64];
+			unsigned slots = poolMgr->used_nodes - (c << MEM_NODE_CHUNK_SHIFT);
+			if (slots > MEM_NODE_CHUNK_NODES) slots = MEM_NODE_CHUNK_NODES;
+			scan(meta, slots, want, span, mask);
+			for (unsigned int w = 0; w < (slots + 63) / 64; w++) {
+				for (uint64_t bits = mask[w]; bits != 0; bits &= bits - 1) {
+					const unsigned slot = w * 64 + (unsigned) __builtin_ctzll(bits);
+					if (best == MEM_NO_NODE || meta[slot] < bestMeta
+					    || (meta[slot] == bestMeta && _chunk_records(chunk)[slot].mem < bestMem)) {
+						best = (c << MEM_NODE_CHUNK_SHIFT) + slot;
+						bestMeta = meta[slot];
+						bestMem = _chunk_records(chunk)[slot].mem;
+					}
+				}
+			}
+		}
+	}
+	return best;
+}
+
+static fit_scan_fn _mem_pick_fit_scan() {
+	// chosen at run time, the library is built for the baseline ISA
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return _mem_fit_scan_avx2;
+	if (__builtin_cpu_supports("sse4.2")) return _mem_fit_scan_sse42;
+#endif
+	return _mem_fit_scan_scalar;
+}
+
+static void _mem_fit_scan_scalar(const uint64_t *meta, unsigned count, uint64_t want, uint64_t span, uint64_t *mask) {
+	// a mask word at a time; fits are rare, so skip ahead to the next one
+	// rather than carry the bits through every step
+	for (unsigned int w = 0; w * 64 < count; w++) {
+		const uint64_t *words = meta + w * 64;
+		const unsigned n = count - w * 64 < 64 ? count - w * 64 : 64;
+		uint64_t bits = 0;
+		for (unsigned int i = 0; ; i++) {
+			while (i < n && words[i] - want >= span) i++;
+			if (i == n) break;
+			bits |= (uint64_t) 1 << i;
+		}
+		mask[w] = bits;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// there is only a signed 64-bit compare; flipping the sign bits of both
+// sides turns it into the unsigned one, meta - want < span
+
+__attribute__((target("sse4.2")))
+static void _mem_fit_scan_sse42(const uint64_t *meta, unsigned count, uint64_t want, uint64_t span, uint64_t *mask) {
+	const __m128i sign = _mm_set1_epi64x((long long) 0x8000000000000000ull);
+	const __m128i vwant = _mm_set1_epi64x((long long) want);
+	const __m128i vspan = _mm_xor_si128(_mm_set1_epi64x((long long) span), sign);
+	for (unsigned int w = 0; w * 64 < count; w++) {
+		const uint64_t *words = meta + w * 64;
+		const unsigned n = count - w * 64 < 64 ? count - w * 64 : 64;
+		uint64_t bits = 0;
+		unsigned int i = 0;
+		if (n == 64) {
+			__m128i any = _mm_setzero_si128();
+			for (; i < 64; i += 2) {
+				const __m128i diff = _mm_xor_si128(_mm_sub_epi64(_mm_loadu_si128((const __m128i *) (words + i)), vwant), sign);
+				any = _mm_or_si128(any, _mm_cmpgt_epi64(vspan, diff));
+			}
+			if (_mm_testz_si128(any, any)) {
+				mask[w] = 0;
+				continue;
+			}
+			i = 0;
+		}
+		for (; i + 2 <= n; i += 2) {
+			const __m128i diff = _mm_xor_si128(_mm_sub_epi64(_mm_loadu_si128((const __m128i *) (words + i)), vwant), sign);
+			bits |= (uint64_t) _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(vspan, diff))) << i;
+		}
+		for (; i < n; i++) {
+			bits |= (uint64_t) (words[i] - want < span) << i;
+		}
+		mask[w] = bits;
+	}
+}
+
+__attribute__((target("avx2")))
+static void _mem_fit_scan_avx2(const uint64_t *meta, unsigned count, uint64_t want, uint64_t span, uint64_t *mask) {
+	const __m256i sign = _mm256_set1_epi64x((long long) 0x8000000000000000ull);
+	const __m256i vwant = _mm256_set1_epi64x((long long) want);
+	const __m256i vspan = _mm256_xor_si256(_mm256_set1_epi64x((long long) span), sign);
+	for (unsigned int w = 0; w * 64 < count; w++) {
+		const uint64_t *words = meta + w * 64;
+		const unsigned n = count - w * 64 < 64 ? count - w * 64 : 64;
+		uint64_t bits = 0;
+		unsigned int i = 0;
+		if (n == 64) {
+			// a full word: find out whether anything fits before
+			// gathering the bits, which is the rare case
+			__m256i any = _mm256_setzero_si256();
+			for (; i < 64; i += 4) {
+				const __m256i diff = _mm256_xor_si256(_mm256_sub_epi64(_mm256_loadu_si256((const __m256i *) (words + i)), vwant), sign);
+				any = _mm256_or_si256(any, _mm256_cmpgt_epi64(vspan, diff));
+			}
+			if (_mm256_testz_si256(any, any)) {
+				mask[w] = 0;
+				continue;
+			}
+			i = 0;
+		}
+		for (; i + 4 <= n; i += 4) {
+			const __m256i diff = _mm256_xor_si256(_mm256_sub_epi64(_mm256_loadu_si256((const __m256i *) (words + i)), vwant), sign);
+			bits |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vspan, diff))) << i;
+		}
+		for (; i < n; i++) {
+			bits |= (uint64_t) (words[i] - want < span) << i;
+		}
+		mask[w] = bits;
+	}
+}
+#endif
+
+static alloc_status _mem_grow_pool(pool_mgr_pt poolMgr, size_t size) {
+	// a trailing gap only needs to be topped up
+	const node_heap_pt heap = &poolMgr->node_heap;
+	const unsigned last = _mem_last_node(poolMgr);
+	const size_t tail = (_node_flags(heap, last) == NODE_USED) ? _node_size(heap, last) : 0;
+	const size_t oldSize = poolMgr->pool.total_size;
+	const size_t needed = oldSize + size - tail;
+
+	size_t newSize = oldSize * MEM_EXPAND_FACTOR;
+	if (newSize < needed) newSize = needed;
+	if (newSize > poolMgr->reserved_size) newSize = poolMgr->reserved_size;
+	if (newSize > MEM_NODE_SIZE_MASK) newSize = MEM_NODE_SIZE_MASK;
+	if (newSize < needed) return ALLOC_FAIL; // reservation exhausted
+
+	// commit whole pages of the reservation, the addresses don't change
+	const size_t page = poolMgr->page_size;
+	const size_t committed = (newSize + page - 1) & ~(page - 1);
+	if (committed > poolMgr->mapped_size) {
+		if (mprotect(poolMgr->pool.mem + poolMgr->mapped_size,
+		             committed - poolMgr->mapped_size, PROT_READ | PROT_WRITE) != 0) {
+			return ALLOC_FAIL;
+		}
+	}
+	const size_t fresh = poolMgr->mapped_size;
+	if (committed > fresh) poolMgr->mapped_size = committed;
+	poolMgr->pool.total_size = newSize;
+
+	alloc_status status;
+	if (tail) {
+		const gap_pt gap = _mem_find_gap(poolMgr, last);
+		if (gap == NULL) return ALLOC_FAIL;
+		_mem_resize_gap(poolMgr, last, _node_size(heap, last) + newSize - oldSize);
+		status = _mem_sort_gap_ix(poolMgr);
+	} else {
+		const unsigned grown = _add_node(poolMgr, last);
+		if (grown == MEM_NO_NODE) return ALLOC_FAIL;
+		_node_record(&poolMgr->node_heap, grown)->mem = poolMgr->pool.mem + oldSize;
+		_set_node_size(&poolMgr->node_heap, grown, newSize - oldSize);
+		_set_node_flags(&poolMgr->node_heap, grown, NODE_USED | NODE_ALLOCATED);
+		status = _add_gap(poolMgr, grown);
+	}
+	// once the new gap is in, adding it gives its pages back
+	if (status == ALLOC_OK && (poolMgr->flags & POOL_PREFAULT) && committed > fresh) {
+		_mem_prefault(poolMgr->pool.mem + fresh, committed - fresh);
+	}
+	return status;
+}
+
+static unsigned _mem_find_node(pool_mgr_pt poolMgr, const char *mem) {
+	// allocation records held on to internally by their memory address
+	// are looked up again here
+	const node_heap_pt heap = &poolMgr->node_heap;
+	unsigned current = poolMgr->head;
+	while (current != MEM_NO_NODE) {
+		if ((_node_flags(heap, current) & NODE_ALLOCATED) && _node_record(heap, current)->mem == mem) {
+			return current;
+		}
+		current = _node_next(heap, current);
+	}
+	return MEM_NO_NODE;
+}
+
+static alloc_status _mem_cache_add_slab(cache_mgr_pt cacheMgr) {
+	const size_t align = cacheMgr->cache.align;
+	const unsigned count = cacheMgr->objs_per_slab;
+
+	if (cacheMgr->cache.num_slabs == cacheMgr->slabs_capacity) {
+		slab_pt *temp = (slab_pt *) realloc(cacheMgr->slabs,
+		        cacheMgr->slabs_capacity * MEM_CACHE_SLAB_STORE_EXPAND_FACTOR * sizeof(slab_pt));
+		if (temp == NULL) return ALLOC_FAIL;
+		cacheMgr->slabs = temp;
+		cacheMgr->slabs_capacity *= MEM_CACHE_SLAB_STORE_EXPAND_FACTOR;
+	}
+
+	const slab_pt slab = (slab_pt) calloc(1, sizeof(slab_t) + count * sizeof(unsigned));
+	if (slab == NULL) return ALLOC_FAIL;
+	const alloc_pt alloc = mem_new_alloc(cacheMgr->cache.pool, align - 1 + count * cacheMgr->stride);
+	if (alloc == NULL) {
+		free(slab);
+		return ALLOC_FAIL;
+	}
+	slab->alloc = alloc;
+	slab->objs = (char *) (((size_t) alloc->mem + align - 1) & ~(align - 1));
+	slab->free_ix = (unsigned *) (slab + 1);
+	for (unsigned i = 0; i < count; i++) {
+		char *obj = slab->objs + i * cacheMgr->stride;
+		if (cacheMgr->ctor) cacheMgr->ctor(obj);
+		slab->free_ix[i] = count - 1 - i; // lowest address handed out first
+	}
+	slab->num_free = count;
+
+	// insert keeping the slab store sorted by address
+	unsigned pos = cacheMgr->cache.num_slabs;
+	while (pos > 0 && cacheMgr->slabs[pos - 1]->objs > slab->objs) {
+		cacheMgr->slabs[pos] = cacheMgr->slabs[pos - 1];
+		pos--;
+	}
+	cacheMgr->slabs[pos] = slab;
+	cacheMgr->cache.num_slabs++;
+
+	slab->next_partial = cacheMgr->partial;
+	cacheMgr->partial = slab;
+	return ALLOC_OK;
+}
+
+static alloc_status _mem_cache_release_slab(cache_mgr_pt cacheMgr, slab_pt slab) {
+	if (cacheMgr->dtor) {
+		for (unsigned i = 0; i < cacheMgr->objs_per_slab; i++) {
+			cacheMgr->dtor(slab->objs + i * cacheMgr->stride);
+		}
+	}
+	if (mem_del_alloc(cacheMgr->cache.pool, slab->alloc) != ALLOC_OK) {
+		return ALLOC_FAIL;
+	}
+
+	// unlink from the partial list
+	slab_pt *link = &(cacheMgr->partial);
+	while (*link && *link != slab) link = &((*link)->next_partial);
+	if (*link) *link = slab->next_partial;
+
+	// pull the following entries of the slab store one position up
+	unsigned pos = 0;
+	while (pos < cacheMgr->cache.num_slabs && cacheMgr->slabs[pos] != slab) pos++;
+	for (unsigned j = pos; j + 1 < cacheMgr->cache.num_slabs; j++) {
+		cacheMgr->slabs[j] = cacheMgr->slabs[j + 1];
+	}
+	cacheMgr->cache.num_slabs--;
+	free(slab);
+	return ALLOC_OK;
+}
+
+static slab_pt _mem_cache_find_slab(cache_mgr_pt cacheMgr, const char *obj) {
+	// binary search over the address-ordered slab store
+	unsigned lower = 0, higher = cacheMgr->cache.num_slabs;
+	const size_t span = cacheMgr->objs_per_slab * cacheMgr->stride;
+	while (lower < higher) {
+		const unsigned mid = lower + (higher - lower) / 2;
+		const slab_pt slab = cacheMgr->slabs[mid];
+		if (obj < slab->objs) {
+			higher = mid;
+		} else if (obj >= slab->objs + span) {
+			lower = mid + 1;
+		} else {
+			return slab;
+		}
+	}
+	return NULL;
+}
+
+static alloc_status _mem_alloc_metadata(pool_mgr_pt poolMgr, unsigned nodes, unsigned gaps) {
+	//Node Heap Allocation
+	poolMgr->used_nodes = 0;
+	poolMgr->free_nodes = MEM_NO_NODE;
+	if (_mem_reserve_node_heap(&poolMgr->node_heap, nodes) != ALLOC_OK) {
+		_mem_free_node_heap(&poolMgr->node_heap);
+		return ALLOC_FAIL;
+	}
+	poolMgr->total_nodes = poolMgr->node_heap.num_chunks * MEM_NODE_CHUNK_NODES;
+	//Gap Index Allocation
+	poolMgr->gap_ix = (gap_pt) calloc(gaps, sizeof(gap_t));
+	poolMgr->gap_ix_capacity = gaps;
+	if (!poolMgr->gap_ix) {
+		_mem_free_node_heap(&poolMgr->node_heap);
+		return ALLOC_FAIL;
+	}
+	return ALLOC_OK;
+}
+
+static alloc_status _mem_init_head(pool_mgr_pt poolMgr) {
+	// the first node spans the whole pool and starts out as its only gap
+	const unsigned head = _add_node(poolMgr, MEM_NO_NODE);
+	if (head == MEM_NO_NODE) return ALLOC_FAIL;
+	poolMgr->head = head;
+	_node_record(&poolMgr->node_heap, head)->mem = poolMgr->pool.mem;
+	_set_node_size(&poolMgr->node_heap, head, poolMgr->pool.total_size);
+	_set_node_flags(&poolMgr->node_heap, head, NODE_USED | NODE_ALLOCATED);
+	return _add_gap(poolMgr, head);
+}
+
+static alloc_status _mem_file_sync(pool_mgr_pt poolMgr) {
+	// write the node heap and gap index after the pool memory, as offsets
+	// and node indices, then the header that points to them; binned
+	// blocks are written as the gaps they become
+	_mem_quick_flush(poolMgr);
+	const node_heap_pt heap = &poolMgr->node_heap;
+	const size_t nodeBytes = poolMgr->used_nodes * sizeof(pool_file_node_t);
+	const size_t gapBytes = poolMgr->pool.num_gaps * sizeof(pool_file_gap_t);
+	char *meta = (char *) malloc(nodeBytes + gapBytes + 1);
+	if (meta == NULL) return ALLOC_FAIL;
+
+	pool_file_node_t *fileNodes = (pool_file_node_t *) meta;
+	for (unsigned int i = 0; i < poolMgr->used_nodes; i++) {
+		fileNodes[i].offset = (uint64_t) (_node_record(heap, i)->mem - poolMgr->pool.mem);
+		fileNodes[i].size = _node_size(heap, i);
+		fileNodes[i].next = _node_next(heap, i) != MEM_NO_NODE ? _node_next(heap, i) : MEM_FILE_NO_NODE;
+		fileNodes[i].prev = _node_prev(heap, i) != MEM_NO_NODE ? _node_prev(heap, i) : MEM_FILE_NO_NODE;
+		fileNodes[i].used = (_node_flags(heap, i) & NODE_USED) ? 1 : 0;
+		fileNodes[i].allocated = !(_node_flags(heap, i) & NODE_ALLOCATED) ? 0
+		                         : (_node_flags(heap, i) & NODE_MOVABLE) ? 2 : 1;
+	}
+	pool_file_gap_t *fileGaps = (pool_file_gap_t *) (meta + nodeBytes);
+	for (unsigned int i = 0; i < poolMgr->pool.num_gaps; i++) {
+		fileGaps[i].size = _node_size(heap, poolMgr->gap_ix[i].node);
+		fileGaps[i].node = poolMgr->gap_ix[i].node;
+	}
+
+	pool_file_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MEM_FILE_MAGIC, sizeof(MEM_FILE_MAGIC));
+	header.version = MEM_FILE_VERSION;
+	header.policy = (uint32_t) poolMgr->pool.policy;
+	header.data_offset = poolMgr->data_offset;
+	header.total_size = poolMgr->pool.total_size;
+	header.alloc_size = poolMgr->pool.alloc_size;
+	header.meta_offset = poolMgr->data_offset + poolMgr->mapped_size;
+	header.num_allocs = poolMgr->pool.num_allocs;
+	header.num_gaps = poolMgr->pool.num_gaps;
+	header.used_nodes = poolMgr->used_nodes;
+	header.head = poolMgr->head;
+
+	alloc_status status = ALLOC_OK;
+	if (msync(poolMgr->pool.mem, poolMgr->mapped_size, MS_SYNC) != 0
+	    || pwrite(poolMgr->fd, meta, nodeBytes + gapBytes, (off_t) header.meta_offset) != (ssize_t) (nodeBytes + gapBytes)
+	    || ftruncate(poolMgr->fd, (off_t) (header.meta_offset + nodeBytes + gapBytes)) != 0
+	    || pwrite(poolMgr->fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)
+	    || fsync(poolMgr->fd) != 0) {
+		status = ALLOC_FAIL;
+	}
+	free(meta);
+	return status;
+}
+
+static alloc_status _mem_file_load(pool_mgr_pt poolMgr, const pool_file_header_t *header) {
+	// restore the node heap and gap index as written, no re-coalescing or
+	// sorting; the open fails on tables that don't describe the pool
+	const unsigned used = header->used_nodes;
+	const unsigned gaps = header->num_gaps;
+	const size_t nodeBytes = used * sizeof(pool_file_node_t);
+	const size_t gapBytes = gaps * sizeof(pool_file_gap_t);
+	const unsigned nodeCapacity = used > MEM_NODE_HEAP_INIT_CAPACITY ? used : MEM_NODE_HEAP_INIT_CAPACITY;
+	unsigned gapCapacity = MEM_GAP_IX_INIT_CAPACITY;
+	while (gaps >= gapCapacity * MEM_GAP_IX_FILL_FACTOR) gapCapacity *= MEM_GAP_IX_EXPAND_FACTOR;
+	struct stat st;
+	if (used == 0 || gaps > used || header->total_size > MEM_NODE_SIZE_MASK
+	    || header->meta_offset != header->data_offset + poolMgr->mapped_size
+	    || fstat(poolMgr->fd, &st) != 0 || header->meta_offset > (uint64_t) st.st_size
+	    || nodeBytes + gapBytes > (uint64_t) st.st_size - header->meta_offset) {
+		return ALLOC_FAIL;
+	}
+
+	char *meta = (char *) malloc(nodeBytes + gapBytes);
+	if (meta == NULL
+	    || pread(poolMgr->fd, meta, nodeBytes + gapBytes, (off_t) header->meta_offset) != (ssize_t) (nodeBytes + gapBytes)
+	    || _mem_file_check(header, (const pool_file_node_t *) meta, (const pool_file_gap_t *) (meta + nodeBytes)) != ALLOC_OK
+	    || _mem_alloc_metadata(poolMgr, nodeCapacity, gapCapacity) != ALLOC_OK) {
+		free(meta);
+		return ALLOC_FAIL;
+	}
+	const node_heap_pt heap = &poolMgr->node_heap;
+	const pool_file_node_t *fileNodes = (const pool_file_node_t *) meta;
+	for (unsigned int i = 0; i < used; i++) {
+		_node_record(heap, i)->mem = poolMgr->pool.mem + fileNodes[i].offset;
+		_set_node_size(heap, i, (size_t) fileNodes[i].size);
+		_set_node_next(heap, i, fileNodes[i].next != MEM_FILE_NO_NODE ? fileNodes[i].next : MEM_NO_NODE);
+		_set_node_prev(heap, i, fileNodes[i].prev != MEM_FILE_NO_NODE ? fileNodes[i].prev : MEM_NO_NODE);
+		_set_node_flags(heap, i, (fileNodes[i].used ? NODE_USED : 0)
+		                         | (fileNodes[i].allocated ? NODE_ALLOCATED : 0)
+		                         | (fileNodes[i].allocated == 2 ? NODE_MOVABLE : 0));
+	}
+	// unlinked slots are free again, lowest first
+	for (unsigned int i = used; i-- > 0; ) {
+		if (_node_flags(heap, i) != 0) {
+			(*_chunk_live(heap->chunks[i >> MEM_NODE_CHUNK_SHIFT]))++;
+			continue;
+		}
+		_set_node_next(heap, i, poolMgr->free_nodes);
+		_set_node_prev(heap, i, MEM_NO_NODE);
+		if (poolMgr->free_nodes != MEM_NO_NODE) _set_node_prev(heap, poolMgr->free_nodes, i);
+		poolMgr->free_nodes = i;
+	}
+	const pool_file_gap_t *fileGaps = (const pool_file_gap_t *) (meta + nodeBytes);
+	for (unsigned int i = 0; i < gaps; i++) {
+		poolMgr->gap_ix[i].node = (uint32_t) fileGaps[i].node;
+		_mem_count_gap(poolMgr, _node_size(heap, poolMgr->gap_ix[i].node), 1);
+	}
+	free(meta);
+
+	poolMgr->used_nodes = used;
+	poolMgr->head = header->head;
+	poolMgr->pool.alloc_size = (size_t) header->alloc_size;
+	poolMgr->pool.num_allocs = header->num_allocs;
+	poolMgr->pool.num_gaps = gaps;
+	return ALLOC_OK;
+}
+
+static alloc_status _mem_file_check(const pool_file_header_t *header, const pool_file_node_t *nodes,
+                                    const pool_file_gap_t *gaps) {
+	// nothing read from the file is trusted: the list from head has to
+	// tile the pool in address order and hold every used slot, with the
+	// header's counts, and the gap table each of its gaps once, by size
+	const unsigned used = header->used_nodes;
+	unsigned numUsed = 0, numAllocs = 0, numGaps = 0;
+	uint64_t end = 0, allocBytes = 0;
+	uint32_t prev = MEM_FILE_NO_NODE;
+	for (unsigned int i = 0; i < used; i++) {
+		if (nodes[i].used > 1 || nodes[i].allocated > 2 || (!nodes[i].used && nodes[i].allocated)) return ALLOC_FAIL;
+		numUsed += nodes[i].used;
+	}
+	for (uint32_t node = header->head; node != MEM_FILE_NO_NODE; node = nodes[node].next) {
+		if (node >= used || !nodes[node].used || nodes[node].prev != prev || nodes[node].offset != end
+		    || nodes[node].size > header->total_size - end || numAllocs + numGaps == numUsed) {
+			return ALLOC_FAIL;
+		}
+		end += nodes[node].size;
+		if (nodes[node].allocated) {
+			numAllocs++;
+			allocBytes += nodes[node].size;
+		} else {
+			numGaps++;
+		}
+		prev = node;
+	}
+	if (end != header->total_size || numAllocs + numGaps != numUsed || numAllocs != header->num_allocs
+	    || numGaps != header->num_gaps || allocBytes != header->alloc_size) {
+		return ALLOC_FAIL;
+	}
+
+	char *seen = (char *) calloc(used, 1);
+	if (seen == NULL) return ALLOC_FAIL;
+	alloc_status status = ALLOC_OK;
+	for (unsigned int i = 0; i < numGaps && status == ALLOC_OK; i++) {
+		const uint64_t node = gaps[i].node;
+		if (node >= used || !nodes[node].used || nodes[node].allocated || seen[node]
+		    || gaps[i].size != nodes[node].size || (i > 0 && gaps[i].size < gaps[i - 1].size)) {
+			status = ALLOC_FAIL;
+		} else {
+			seen[node] = 1;
+		}
+	}
+	free(seen);
+	return status;
+}
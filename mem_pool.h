@@ -7,9 +7,21 @@
 
 #include <stddef.h>
 
+#define MEM_SHARED_NULL ((size_t) -1) // offset returned by a failed shared allocation
+#define MEM_STATS_BUCKETS 48          // log2 buckets of gap sizes, sizes are 48-bit
+#define MEM_ROUTE_REST ((size_t) -1)  // mem_pool_route: the size class of everything larger
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* type declarations */
 
-typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
+typedef enum _alloc_policy {
+    FIRST_FIT,
+    BEST_FIT,
+    AUTO_FIT    // picks FIRST_FIT or BEST_FIT and quick bins from what it sees; BEST_FIT in shared pools
+} alloc_policy;
 
 typedef struct _pool {
     char *mem;
@@ -20,6 +32,31 @@ typedef struct _pool {
     unsigned num_gaps;
 } pool_t, *pool_pt;
 
+typedef enum _pool_flags {
+    POOL_HUGE_PAGES = 0x1,  // back with 2 MB huge pages, normal pages if unavailable
+    POOL_GROWABLE   = 0x2,  // reserve reserve_size, commit more on exhaustion (normal pages)
+    POOL_NUMA_BIND  = 0x4,  // place pages on numa_node, ignored on single-node machines
+    POOL_NUMA_INTERLEAVE = 0x8, // spread pages round-robin over all online nodes
+    POOL_QUICK_BINS = 0x10, // park small freed blocks for same-size reuse, coalesce them later
+    POOL_SMALL_OBJECTS = 0x20, // serve requests up to 64 bytes from bitmap slabs, no node each
+    POOL_SCALAR_SCAN = 0x40, // best-fit scans without SIMD, even if the CPU has it
+    POOL_PREFAULT   = 0x80  // fault all committed pages in at open (and growth), not on first use
+} pool_flags;
+
+typedef struct _pool_options {
+    unsigned flags;         // bitwise or of pool_flags
+    size_t reserve_size;    // POOL_GROWABLE: upper bound for total_size
+    int numa_node;          // POOL_NUMA_BIND: node the pool memory lives on
+    size_t large_threshold; // larger requests get a mapping of their own, 0 for none
+    unsigned expected_allocs; // capacity hints: size the node heap and gap index
+    unsigned expected_gaps;   // for this many up front, 0 for the defaults
+} pool_options_t, *pool_options_pt;
+
+typedef struct _pool_shards {
+    unsigned num_shards;    // one pool per NUMA node, 1 on single-node machines
+    pool_pt *pools;         // indexed by node
+} pool_shards_t, *pool_shards_pt;
+
 typedef struct _alloc {
     size_t size;
     char *mem;
@@ -37,6 +74,47 @@ typedef enum _alloc_status {
     ALLOC_NOT_FREED
 } alloc_status;
 
+typedef struct _pool_stats {
+    size_t free_bytes;          // total_size - alloc_size
+    size_t binned_bytes;        // POOL_QUICK_BINS: part of free_bytes, not in gaps yet
+    size_t largest_gap;
+    unsigned num_gaps;
+    double fragmentation;       // external: 1 - largest_gap / free_bytes, 0 if full
+    alloc_policy fit;           // the fit in use, AUTO_FIT pools switch between the other two
+    int quick_bins;             // 1 if freed small blocks go to quick bins
+    unsigned gap_histogram[MEM_STATS_BUCKETS]; // [i]: gaps of [2^i, 2^(i+1)) bytes
+} pool_stats_t, *pool_stats_pt;
+
+typedef struct _scavenger_options {
+    unsigned interval_ms;       // time between passes over the pool store
+    unsigned idle_ms;           // gaps untouched this long have their pages released
+    size_t max_bytes_per_pass;  // rate limit, 0 for none
+} scavenger_options_t, *scavenger_options_pt;
+
+typedef struct _scavenger_stats {
+    unsigned long passes;
+    unsigned long throttled_passes; // passes cut short by max_bytes_per_pass
+    unsigned long gaps_released;    // gaps whose pages are all back with the OS
+    size_t bytes_released;
+} scavenger_stats_t, *scavenger_stats_pt;
+
+typedef struct _shared_pool {
+    char *mem;          // pool memory, mapped at a different address in each process
+    size_t total_size;
+    int fd;             // memfd or shared memory object
+} shared_pool_t, *shared_pool_pt;
+
+typedef void (*cache_ctor)(void *obj);
+typedef void (*cache_dtor)(void *obj);
+
+typedef struct _cache {
+    pool_pt pool;
+    size_t obj_size;
+    size_t align;
+    unsigned num_objs;  // objects handed out to the user
+    unsigned num_slabs; // slabs currently carved from the pool
+} cache_t, *cache_pt;
+
 /* function declarations */
 
 alloc_status
@@ -48,16 +126,119 @@ mem_free();
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_opts(size_t size, alloc_policy policy, const pool_options_t *options);
+
+pool_pt
+mem_pool_open_sub(pool_pt parent, size_t size, alloc_policy policy);
+
+// The pool memory is a shared mapping of the file and reaches the disk as
+// the kernel writes it back, but the node heap and gap index are only
+// written by mem_pool_sync and mem_pool_close. After a crash the file
+// reopens with the allocations of the last sync; anything allocated or
+// freed since is lost, and its memory may have been written regardless.
+// A file whose tables don't describe the pool fails to open, with NULL.
+pool_pt
+mem_pool_open_file(const char *path, size_t size, alloc_policy policy);
+
+alloc_status
+mem_pool_sync(pool_pt pool);
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
+alloc_status
+mem_pool_trim(pool_pt pool, size_t keep_bytes);
+
+size_t
+mem_pool_compact(pool_pt pool, unsigned long budget_us);
+
+alloc_status
+mem_pool_stats(pool_pt pool, pool_stats_pt stats);
+
+alloc_status
+mem_scavenger_start(const scavenger_options_t *options);
+
+alloc_status
+mem_scavenger_stop();
+
+void
+mem_scavenger_stats(scavenger_stats_pt stats);
+
+pool_shards_pt
+mem_pool_open_sharded(size_t size, alloc_policy policy, const pool_options_t *options);
+
+pool_pt
+mem_pool_shard(pool_shards_pt shards);
+
+alloc_status
+mem_pool_close_sharded(pool_shards_pt shards);
+
+alloc_status
+mem_pool_route(pool_pt pool, size_t max_size);
+
+pool_pt
+mem_pool_of(const char *mem);
+
 alloc_pt
 mem_new_alloc(pool_pt pool, size_t size);
 
+alloc_pt
+mem_new_handle(pool_pt pool, size_t size);
+
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
+alloc_pt
+mem_new_alloc_routed(size_t size);
+
+alloc_status
+mem_del_alloc_routed(alloc_pt alloc);
+
+alloc_pt
+mem_find_alloc(pool_pt pool, const char *mem);
+
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+cache_pt
+mem_cache_create(pool_pt pool, size_t obj_size, size_t align, cache_ctor ctor, cache_dtor dtor);
+
+alloc_status
+mem_cache_destroy(cache_pt cache);
+
+void *
+mem_cache_alloc(cache_pt cache);
+
+alloc_status
+mem_cache_free(cache_pt cache, void *obj);
+
+shared_pool_pt
+mem_shared_pool_create(const char *name, size_t size, alloc_policy policy);
+
+shared_pool_pt
+mem_shared_pool_attach(const char *name);
+
+shared_pool_pt
+mem_shared_pool_attach_fd(int fd);
+
+alloc_status
+mem_shared_pool_detach(shared_pool_pt pool);
+
+size_t
+mem_shared_alloc(shared_pool_pt pool, size_t size);
+
+alloc_status
+mem_shared_free(shared_pool_pt pool, size_t offset);
+
+char *
+mem_shared_ptr(shared_pool_pt pool, size_t offset);
+
+void
+mem_shared_inspect_pool(shared_pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif //DENVER_OS_PA_C_MEM_POOL_H
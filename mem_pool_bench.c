@@ -0,0 +1,440 @@
+/*
+ * Benchmarks for the mem_pool library.
+ *
+ * Usage: mem_pool_bench [pool size in MB]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <malloc.h>
+#include "mem_pool.h"
+
+
+/*****            constants            *****/
+
+static const size_t   BENCH_POOL_SIZE_MB     = 512;
+static const unsigned BENCH_NUM_BLOCKS       = 16;   // stays within the initial node heap
+static const unsigned long BENCH_ACCESSES    = 20000000;
+static const unsigned BENCH_SCAN_SEGMENTS    = 131072;
+static const unsigned BENCH_SCAN_BLOCK       = 16;
+static const unsigned BENCH_SCAN_PROBES      = 200;
+static const unsigned BENCH_GAP_PROBES       = 20000;
+static const unsigned BENCH_CHURN_LIVE       = 100;
+static const unsigned BENCH_CHURN_CYCLES     = 100000;
+static const unsigned BENCH_CHURN_WINDOWS    = 10;
+static const unsigned BENCH_META_ALLOCS      = 30000;
+static const unsigned BENCH_REUSE_LIVE       = 4096;
+static const unsigned BENCH_REUSE_OPS        = 1000000;
+static const unsigned BENCH_SESSIONS         = 20000;
+static const size_t   BENCH_SESSION_SIZE     = 16 * 1024;
+static const unsigned BENCH_BURST_ALLOCS     = 2000;
+static const size_t   BENCH_BURST_SIZE       = 4096;
+static const unsigned BENCH_PHASE_LIVE       = 4096;
+static const unsigned BENCH_PHASE_OPS        = 20000;
+
+
+/*****         helper routines         *****/
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static size_t heap_bytes(void) {
+    // everything the library has taken from malloc, mmap-served blocks included
+    const struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+
+/*****           benchmarks            *****/
+
+static void bench_random_access(size_t pool_size, unsigned flags) {
+    pool_options_t options = { .flags = flags };
+    const size_t block_size = pool_size / BENCH_NUM_BLOCKS;
+    alloc_pt blocks[BENCH_NUM_BLOCKS];
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    uint64_t sum = 0;
+
+    pool_pt pool = mem_pool_open_opts(pool_size, FIRST_FIT, &options);
+    if (pool == NULL) {
+        printf("pool open failed\n");
+        return;
+    }
+    for (unsigned b = 0; b < BENCH_NUM_BLOCKS; b++) {
+        blocks[b] = mem_new_alloc(pool, block_size);
+        memset(blocks[b]->mem, (int) b, block_size);
+    }
+
+    const double start = now_sec();
+    for (unsigned long i = 0; i < BENCH_ACCESSES; i++) {
+        const uint64_t r = xorshift(&rng);
+        char *mem = blocks[r % BENCH_NUM_BLOCKS]->mem;
+        uint64_t *word = (uint64_t *) (mem + ((r >> 8) % (block_size / 8)) * 8);
+        sum += *word;
+        *word = r;
+    }
+    const double elapsed = now_sec() - start;
+
+    printf("%-24s %8.2f Maccesses/s  (%zu MB, checksum %llx)\n",
+           (flags & POOL_HUGE_PAGES) ? "random access, huge" : "random access, normal",
+           BENCH_ACCESSES / elapsed / 1e6, pool_size >> 20, (unsigned long long) sum);
+
+    for (unsigned b = 0; b < BENCH_NUM_BLOCKS; b++) {
+        mem_del_alloc(pool, blocks[b]);
+    }
+    mem_pool_close(pool);
+}
+
+
+static void bench_fit_scan(alloc_policy policy, unsigned segments) {
+    // fill a pool with small allocations, leaving a tail gap too small for
+    // the probes; each probe then scans the whole node heap and fails
+    const size_t pool_size = (size_t) (segments + 1) * BENCH_SCAN_BLOCK;
+    pool_pt pool = mem_pool_open(pool_size, BEST_FIT); // the quicker fill
+    if (pool == NULL) {
+        printf("pool open failed\n");
+        return;
+    }
+    for (unsigned s = 0; s < segments; s++) {
+        if (mem_new_alloc(pool, BENCH_SCAN_BLOCK) == NULL) {
+            printf("allocation %u failed\n", s);
+            return;
+        }
+    }
+    pool->policy = policy;
+
+    const double start = now_sec();
+    for (unsigned p = 0; p < BENCH_SCAN_PROBES; p++) {
+        if (mem_new_alloc(pool, BENCH_SCAN_BLOCK * 2) != NULL) printf("probe fit unexpectedly\n");
+    }
+    const double elapsed = now_sec() - start;
+
+    printf("%-24s %8.2f ns/segment  (%u segments)\n",
+           policy == FIRST_FIT ? "fit scan, first fit" : "fit scan, best fit",
+           elapsed * 1e9 / ((double) BENCH_SCAN_PROBES * (segments + 1)), segments + 1);
+
+    // the pool keeps its allocations, mem_free tears it down with the rest
+}
+
+
+static void bench_gap_scan(unsigned gaps, unsigned flags) {
+    // best-fit probes that miss, so each one scans all the nodes: gaps
+    // gaps too small for the probe, between as many allocations
+    pool_options_t options = { .flags = flags };
+    const size_t pool_size = (size_t) 2 * gaps * BENCH_SCAN_BLOCK;
+    alloc_pt *handles = (alloc_pt *) malloc(2 * gaps * sizeof(alloc_pt));
+    pool_pt pool = mem_pool_open_opts(pool_size, BEST_FIT, &options);
+    if (handles == NULL || pool == NULL) {
+        printf("pool open failed\n");
+        free(handles);
+        return;
+    }
+    for (unsigned a = 0; a < 2 * gaps; a++) {
+        handles[a] = mem_new_alloc(pool, BENCH_SCAN_BLOCK);
+    }
+    for (unsigned a = 0; a < 2 * gaps; a += 2) {
+        mem_del_alloc(pool, handles[a]);
+    }
+
+    const unsigned probes = BENCH_GAP_PROBES * 1000 / gaps + 1;
+    const double start = now_sec();
+    for (unsigned p = 0; p < probes; p++) {
+        if (mem_new_alloc(pool, BENCH_SCAN_BLOCK * 2) != NULL) printf("probe fit unexpectedly\n");
+    }
+    const double elapsed = now_sec() - start;
+
+    printf("%-24s %8.2f ns/gap      (%u gaps, %.1f us/probe)\n",
+           (flags & POOL_SCALAR_SCAN) ? "gap scan, scalar" : "gap scan, vector",
+           elapsed * 1e9 / ((double) probes * gaps), gaps, elapsed * 1e6 / probes);
+
+    for (unsigned a = 1; a < 2 * gaps; a += 2) {
+        mem_del_alloc(pool, handles[a]);
+    }
+    mem_pool_close(pool);
+    free(handles);
+}
+
+
+static void bench_churn_scan(unsigned flags) {
+    // best fit around long-lived blocks, through many cycles of two blocks
+    // allocated and freed: each cycle unlinks nodes, so the sweep stays
+    // flat only if their slots are reused; first and last window compared
+    pool_options_t options = { .flags = flags };
+    const size_t pool_size = (size_t) 4 * BENCH_CHURN_LIVE * BENCH_SCAN_BLOCK;
+    alloc_pt *handles = (alloc_pt *) malloc(2 * BENCH_CHURN_LIVE * sizeof(alloc_pt));
+    pool_pt pool = mem_pool_open_opts(pool_size, BEST_FIT, &options);
+    double windows[2] = { 0.0, 0.0 };
+    if (handles == NULL || pool == NULL) {
+        printf("pool open failed\n");
+        free(handles);
+        return;
+    }
+    for (unsigned a = 0; a < 2 * BENCH_CHURN_LIVE; a++) {
+        handles[a] = mem_new_alloc(pool, BENCH_SCAN_BLOCK);
+    }
+    for (unsigned a = 0; a < 2 * BENCH_CHURN_LIVE; a += 2) {
+        mem_del_alloc(pool, handles[a]);
+    }
+
+    const unsigned window = BENCH_CHURN_CYCLES / BENCH_CHURN_WINDOWS;
+    for (unsigned w = 0; w < BENCH_CHURN_WINDOWS; w++) {
+        const double start = now_sec();
+        for (unsigned c = 0; c < window; c++) {
+            alloc_pt first = mem_new_alloc(pool, BENCH_SCAN_BLOCK * 4 + c % 64);
+            alloc_pt second = mem_new_alloc(pool, BENCH_SCAN_BLOCK * 4 + (c + 1) % 64);
+            if (first == NULL || second == NULL) {
+                printf("allocation failed\n");
+                return;
+            }
+            mem_del_alloc(pool, (c & 1) ? first : second);
+            mem_del_alloc(pool, (c & 1) ? second : first);
+        }
+        const double elapsed = now_sec() - start;
+        if (w == 0) windows[0] = elapsed;
+        if (w == BENCH_CHURN_WINDOWS - 1) windows[1] = elapsed;
+    }
+
+    printf("%-24s %8.2f ns/op      (%.2f ns/op in the first window, %u cycles)\n",
+           (flags & POOL_SCALAR_SCAN) ? "churn scan, scalar" : "churn scan, vector",
+           windows[1] * 1e9 / (2.0 * window), windows[0] * 1e9 / (2.0 * window), BENCH_CHURN_CYCLES);
+
+    for (unsigned a = 1; a < 2 * BENCH_CHURN_LIVE; a += 2) {
+        mem_del_alloc(pool, handles[a]);
+    }
+    mem_pool_close(pool);
+    free(handles);
+}
+
+
+static void bench_metadata(unsigned allocs, unsigned flags) {
+    // node heap and gap index bytes per allocation, growth slack included:
+    // first with every segment allocated, then with every other one freed
+    pool_options_t options = { .flags = flags };
+    alloc_pt *handles = (alloc_pt *) malloc(allocs * sizeof(alloc_pt));
+    const size_t before = heap_bytes();
+    pool_pt pool = mem_pool_open_opts((size_t) (allocs + 1) * BENCH_SCAN_BLOCK, BEST_FIT, &options);
+    if (handles == NULL || pool == NULL) {
+        printf("pool open failed\n");
+        free(handles);
+        return;
+    }
+    for (unsigned a = 0; a < allocs; a++) {
+        handles[a] = mem_new_alloc(pool, BENCH_SCAN_BLOCK);
+        if (handles[a] == NULL) {
+            printf("allocation %u failed\n", a);
+            free(handles);
+            return;
+        }
+    }
+    const size_t full = heap_bytes() - before;
+
+    for (unsigned a = 0; a < allocs; a += 2) {
+        mem_del_alloc(pool, handles[a]);
+    }
+    const size_t holey = heap_bytes() - before;
+
+    printf("%-24s %8.2f bytes/alloc  (%u allocs; %.2f bytes/alloc, %.2f bytes/segment with every other freed)\n",
+           (flags & POOL_SMALL_OBJECTS) ? "metadata, small objects" : "metadata",
+           (double) full / allocs, allocs, (double) holey / (allocs / 2), (double) holey / allocs);
+    free(handles);
+}
+
+
+static void bench_reuse(alloc_policy policy, unsigned flags) {
+    // free a random live block and allocate one of the same size right
+    // away, with a few thousand small blocks of mixed sizes live
+    pool_options_t options = { .flags = flags };
+    alloc_pt *live = (alloc_pt *) malloc(BENCH_REUSE_LIVE * sizeof(alloc_pt));
+    pool_pt pool = mem_pool_open_opts((size_t) BENCH_REUSE_LIVE * 256, policy, &options);
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    if (live == NULL || pool == NULL) {
+        printf("pool open failed\n");
+        free(live);
+        return;
+    }
+    for (unsigned l = 0; l < BENCH_REUSE_LIVE; l++) {
+        live[l] = mem_new_alloc(pool, 16 + (l % 8) * 16);
+    }
+
+    const double start = now_sec();
+    for (unsigned long i = 0; i < BENCH_REUSE_OPS; i++) {
+        const unsigned l = (unsigned) (xorshift(&rng) % BENCH_REUSE_LIVE);
+        const size_t size = live[l]->size;
+        mem_del_alloc(pool, live[l]);
+        live[l] = mem_new_alloc(pool, size);
+    }
+    const double elapsed = now_sec() - start;
+
+    printf("%-24s %8.2f ns/op  (%s, %u live)\n",
+           (flags & POOL_QUICK_BINS) ? "free+alloc, quick bins" : "free+alloc, coalescing",
+           elapsed * 1e9 / BENCH_REUSE_OPS, policy == FIRST_FIT ? "first fit" : "best fit", BENCH_REUSE_LIVE);
+
+    for (unsigned l = 0; l < BENCH_REUSE_LIVE; l++) {
+        mem_del_alloc(pool, live[l]);
+    }
+    mem_pool_close(pool);
+    free(live);
+}
+
+
+static void bench_sessions(int nested) {
+    // open a small pool, allocate from it and close it again, as a
+    // per-session pool would be; on its own mapping or carved from a parent
+    pool_pt parent = nested ? mem_pool_open(BENCH_SESSION_SIZE * 4, FIRST_FIT) : NULL;
+    if (nested && parent == NULL) {
+        printf("pool open failed\n");
+        return;
+    }
+
+    const double start = now_sec();
+    for (unsigned s = 0; s < BENCH_SESSIONS; s++) {
+        pool_pt pool = nested ? mem_pool_open_sub(parent, BENCH_SESSION_SIZE, FIRST_FIT)
+                              : mem_pool_open(BENCH_SESSION_SIZE, FIRST_FIT);
+        if (pool == NULL) {
+            printf("session %u failed\n", s);
+            return;
+        }
+        alloc_pt alloc = mem_new_alloc(pool, 256);
+        memset(alloc->mem, 0, 256);
+        mem_del_alloc(pool, alloc);
+        mem_pool_close(pool);
+    }
+    const double elapsed = now_sec() - start;
+
+    printf("%-24s %8.2f us/session  (%zu KB pools)\n",
+           nested ? "session, sub-pool" : "session, own mapping",
+           elapsed * 1e6 / BENCH_SESSIONS, BENCH_SESSION_SIZE >> 10);
+    if (parent) mem_pool_close(parent);
+}
+
+
+static void bench_first_burst(int hinted) {
+    // the first burst of allocations on a fresh pool, each one written to:
+    // page faults and node heap growth on the way, or neither with the
+    // capacity hints and prefaulting
+    pool_options_t options = { .flags = hinted ? POOL_PREFAULT : 0 };
+    alloc_pt *handles = (alloc_pt *) malloc(BENCH_BURST_ALLOCS * sizeof(alloc_pt));
+    if (hinted) {
+        options.expected_allocs = BENCH_BURST_ALLOCS;
+        options.expected_gaps = BENCH_BURST_ALLOCS / 2;
+    }
+    pool_pt pool = mem_pool_open_opts((size_t) BENCH_BURST_ALLOCS * BENCH_BURST_SIZE, BEST_FIT, &options);
+    if (handles == NULL || pool == NULL) {
+        printf("pool open failed\n");
+        free(handles);
+        return;
+    }
+
+    const double start = now_sec();
+    for (unsigned a = 0; a < BENCH_BURST_ALLOCS; a++) {
+        handles[a] = mem_new_alloc(pool, BENCH_BURST_SIZE);
+        memset(handles[a]->mem, 0, BENCH_BURST_SIZE);
+    }
+    const double elapsed = now_sec() - start;
+
+    printf("%-24s %8.2f ns/alloc  (%u allocs of %zu bytes)\n",
+           hinted ? "first burst, prefaulted" : "first burst",
+           elapsed * 1e9 / BENCH_BURST_ALLOCS, BENCH_BURST_ALLOCS, BENCH_BURST_SIZE);
+
+    for (unsigned a = 0; a < BENCH_BURST_ALLOCS; a++) {
+        mem_del_alloc(pool, handles[a]);
+    }
+    mem_pool_close(pool);
+    free(handles);
+}
+
+
+static void bench_phases(alloc_policy policy) {
+    // a tenant whose pattern changes halfway: small blocks of a few sizes
+    // replaced at random, then blocks of random sizes up to 2 KB replaced
+    // by blocks of other sizes, which fragments the pool
+    alloc_pt *live = (alloc_pt *) malloc(BENCH_PHASE_LIVE * sizeof(alloc_pt));
+    pool_pt pool = mem_pool_open((size_t) BENCH_PHASE_LIVE * 4096, policy);
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    double elapsed[2];
+    if (live == NULL || pool == NULL) {
+        printf("pool open failed\n");
+        free(live);
+        return;
+    }
+
+    for (unsigned phase = 0; phase < 2; phase++) {
+        for (unsigned l = 0; l < BENCH_PHASE_LIVE; l++) {
+            live[l] = mem_new_alloc(pool, phase ? 64 + xorshift(&rng) % 1985 : 16 + (l % 4) * 16);
+        }
+        const double start = now_sec();
+        for (unsigned i = 0; i < BENCH_PHASE_OPS; i++) {
+            const unsigned l = (unsigned) (xorshift(&rng) % BENCH_PHASE_LIVE);
+            const size_t size = phase ? 64 + xorshift(&rng) % 1985 : live[l]->size;
+            mem_del_alloc(pool, live[l]);
+            live[l] = mem_new_alloc(pool, size);
+            if (live[l] == NULL) {
+                printf("allocation failed\n");
+                return;
+            }
+        }
+        elapsed[phase] = now_sec() - start;
+        for (unsigned l = 0; l < BENCH_PHASE_LIVE; l++) {
+            mem_del_alloc(pool, live[l]);
+        }
+    }
+
+    printf("%-24s %8.2f ns/op  (small churn %.2f ns/op, fragmenting %.2f ns/op)\n",
+           policy == AUTO_FIT ? "phases, auto fit" : policy == BEST_FIT ? "phases, best fit" : "phases, first fit",
+           (elapsed[0] + elapsed[1]) * 1e9 / (2.0 * BENCH_PHASE_OPS),
+           elapsed[0] * 1e9 / BENCH_PHASE_OPS, elapsed[1] * 1e9 / BENCH_PHASE_OPS);
+
+    mem_pool_close(pool);
+    free(live);
+}
+
+
+/*****              driver             *****/
+
+int main(int argc, char *argv[]) {
+    size_t pool_mb = BENCH_POOL_SIZE_MB;
+    if (argc > 1) pool_mb = strtoul(argv[1], NULL, 10);
+
+    mem_init();
+    bench_random_access(pool_mb << 20, 0);
+    bench_random_access(pool_mb << 20, POOL_HUGE_PAGES);
+    bench_fit_scan(FIRST_FIT, BENCH_SCAN_SEGMENTS);
+    bench_fit_scan(BEST_FIT, BENCH_SCAN_SEGMENTS);
+    for (unsigned gaps = 1000; gaps <= 100000; gaps *= 10) {
+        bench_gap_scan(gaps, POOL_SCALAR_SCAN);
+        bench_gap_scan(gaps, 0);
+    }
+    bench_churn_scan(POOL_SCALAR_SCAN);
+    bench_churn_scan(0);
+    bench_metadata(BENCH_META_ALLOCS, 0);
+    bench_metadata(BENCH_META_ALLOCS, POOL_SMALL_OBJECTS);
+    bench_reuse(FIRST_FIT, 0);
+    bench_reuse(FIRST_FIT, POOL_QUICK_BINS);
+    bench_reuse(BEST_FIT, 0);
+    bench_reuse(BEST_FIT, POOL_QUICK_BINS);
+    bench_sessions(0);
+    bench_sessions(1);
+    bench_first_burst(0);
+    bench_first_burst(1);
+    bench_phases(FIRST_FIT);
+    bench_phases(BEST_FIT);
+    bench_phases(AUTO_FIT);
+    mem_free();
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * A std::pmr::memory_resource over a mem_pool pool, so that the pmr
+ * containers can allocate from it:
+ *
+ *     mem::pool_resource resource(mem_pool_open(size, BEST_FIT));
+ *     std::pmr::vector<int> v(&resource);
+ *
+ * The resource doesn't own the pool; open and close it with the C API.
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_POOL_RESOURCE_HPP
+#define DENVER_OS_PA_C_MEM_POOL_RESOURCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <new>
+
+#include "mem_pool.h"
+
+namespace mem {
+
+class pool_resource : public std::pmr::memory_resource {
+public:
+    explicit pool_resource(pool_pt pool) noexcept : pool_(pool) {}
+
+    pool_pt pool() const noexcept { return pool_; }
+
+private:
+    // each block is over-allocated by a record pointer and the alignment
+    // slack; the pointer handed out is rounded up to the alignment asked
+    // for, and the record is stored just below it, where do_deallocate
+    // reads it back for mem_del_alloc
+    static constexpr std::size_t header_size = sizeof(alloc_pt);
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (alignment < alignof(alloc_pt)) alignment = alignof(alloc_pt);
+        const std::size_t extra = header_size + alignment - 1;
+        if (bytes > SIZE_MAX - extra) throw std::bad_alloc();
+        const alloc_pt alloc = mem_new_alloc(pool_, bytes + extra);
+        if (alloc == nullptr) throw std::bad_alloc();
+
+        const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(alloc->mem) + header_size;
+        char *mem = reinterpret_cast<char *>((base + alignment - 1) & ~(std::uintptr_t) (alignment - 1));
+        std::memcpy(mem - header_size, &alloc, header_size);
+        return mem;
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+        (void) bytes;
+        (void) alignment;
+        alloc_pt alloc;
+        std::memcpy(&alloc, static_cast<char *>(p) - header_size, header_size);
+        mem_del_alloc(pool_, alloc);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        // memory from one pool can go back through any resource over it
+        const pool_resource *that = dynamic_cast<const pool_resource *>(&other);
+        return that != nullptr && that->pool_ == pool_;
+    }
+
+    pool_pt pool_;
+};
+
+} // namespace mem
+
+#endif //DENVER_OS_PA_C_MEM_POOL_RESOURCE_HPP
@@ -0,0 +1,182 @@
+/*
+ * Benchmarks for the C++ interfaces: the std::pmr adapter against the
+ * default resource, and the compile-time specialized pool against the
+ * C API.
+ *
+ * Usage: mem_pool_resource_bench [elements]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "mem_pool.h"
+#include "mem_pool_resource.hpp"
+#include "mem_pool_static.hpp"
+
+
+/*****            constants            *****/
+
+static const unsigned long BENCH_ELEMENTS   = 100000;
+static const unsigned      BENCH_ROUNDS     = 10;
+static constexpr size_t    BENCH_POOL_SIZE  = 64 * 1024 * 1024;
+static const unsigned      BENCH_CHURN_LIVE = 4096;
+static const unsigned long BENCH_CHURN_OPS  = 1000000;
+
+
+/*****         helper routines         *****/
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+
+/*****           benchmarks            *****/
+
+static void bench_map(std::pmr::memory_resource *resource, const char *name, unsigned long elements) {
+    // fill a map and empty it again, a node allocation and free per element
+    uint64_t sum = 0;
+
+    const double start = now_sec();
+    for (unsigned r = 0; r < BENCH_ROUNDS; r++) {
+        std::pmr::unordered_map<uint64_t, uint64_t> map(resource);
+        for (unsigned long e = 0; e < elements; e++) {
+            map.emplace(e * 0x9E3779B97F4A7C15ull, e);
+        }
+        for (unsigned long e = 0; e < elements; e += 2) {
+            map.erase(e * 0x9E3779B97F4A7C15ull);
+        }
+        for (const auto &entry : map) sum += entry.second;
+    }
+    const double elapsed = now_sec() - start;
+
+    printf("%-24s %8.2f ns/element  (%lu elements, checksum %llx)\n",
+           name, elapsed * 1e9 / ((double) BENCH_ROUNDS * elements), elements, (unsigned long long) sum);
+}
+
+
+static void bench_vectors(std::pmr::memory_resource *resource, const char *name, unsigned long elements) {
+    // many short vectors grown one element at a time, reallocating as they go
+    const unsigned long length = 64;
+    uint64_t sum = 0;
+
+    const double start = now_sec();
+    for (unsigned r = 0; r < BENCH_ROUNDS; r++) {
+        std::pmr::vector<std::pmr::vector<uint64_t>> outer(resource);
+        outer.reserve(elements / length);
+        for (unsigned long v = 0; v < elements / length; v++) {
+            outer.emplace_back();
+            for (unsigned long e = 0; e < length; e++) outer.back().push_back(v + e);
+        }
+        for (const auto &inner : outer) sum += inner.back();
+    }
+    const double elapsed = now_sec() - start;
+
+    printf("%-24s %8.2f ns/element  (%lu elements, checksum %llx)\n",
+           name, elapsed * 1e9 / ((double) BENCH_ROUNDS * elements), elements, (unsigned long long) sum);
+}
+
+
+static void bench_churn_c(void) {
+    // free a random live block and allocate one of the same size, sizes
+    // drawn from a few small classes; through the C API
+    pool_options_t options{};
+    options.flags = POOL_SMALL_OBJECTS | POOL_QUICK_BINS;
+    pool_pt pool = mem_pool_open_opts(BENCH_POOL_SIZE, BEST_FIT, &options);
+    std::vector<alloc_pt> live(BENCH_CHURN_LIVE);
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    if (pool == NULL) {
+        printf("pool open failed\n");
+        return;
+    }
+    for (unsigned l = 0; l < BENCH_CHURN_LIVE; l++) {
+        live[l] = mem_new_alloc(pool, (size_t) 16 << (l % 4));
+    }
+
+    const double start = now_sec();
+    for (unsigned long i = 0; i < BENCH_CHURN_OPS; i++) {
+        const unsigned l = (unsigned) (xorshift(&rng) % BENCH_CHURN_LIVE);
+        const size_t size = live[l]->size;
+        mem_del_alloc(pool, live[l]);
+        live[l] = mem_new_alloc(pool, size);
+    }
+    const double elapsed = now_sec() - start;
+
+    printf("%-24s %8.2f ns/op  (%u live)\n", "churn, C API", elapsed * 1e9 / BENCH_CHURN_OPS, BENCH_CHURN_LIVE);
+
+    for (unsigned l = 0; l < BENCH_CHURN_LIVE; l++) {
+        mem_del_alloc(pool, live[l]);
+    }
+    mem_pool_close(pool);
+}
+
+
+static void bench_churn_static(void) {
+    // the same, on a pool with the classes and policy fixed at compile time
+    mem::pool<BENCH_POOL_SIZE, BEST_FIT, 16, 32, 64, 128> pool;
+    std::vector<void *> live(BENCH_CHURN_LIVE);
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    for (unsigned l = 0; l < BENCH_CHURN_LIVE; l++) {
+        live[l] = pool.allocate((size_t) 16 << (l % 4));
+    }
+
+    const double start = now_sec();
+    for (unsigned long i = 0; i < BENCH_CHURN_OPS; i++) {
+        const unsigned l = (unsigned) (xorshift(&rng) % BENCH_CHURN_LIVE);
+        const size_t size = (size_t) 16 << (l % 4);
+        pool.deallocate(live[l], size);
+        live[l] = pool.allocate(size);
+    }
+    const double elapsed = now_sec() - start;
+
+    printf("%-24s %8.2f ns/op  (%u live)\n", "churn, static pool", elapsed * 1e9 / BENCH_CHURN_OPS, BENCH_CHURN_LIVE);
+
+    for (unsigned l = 0; l < BENCH_CHURN_LIVE; l++) {
+        pool.deallocate(live[l], (size_t) 16 << (l % 4));
+    }
+}
+
+
+/*****              driver             *****/
+
+int main(int argc, char *argv[]) {
+    unsigned long elements = BENCH_ELEMENTS;
+    if (argc > 1) elements = strtoul(argv[1], NULL, 10);
+
+    mem_init();
+    pool_options_t options{};
+    options.flags = POOL_SMALL_OBJECTS | POOL_QUICK_BINS;
+    pool_pt pool = mem_pool_open_opts(BENCH_POOL_SIZE, BEST_FIT, &options);
+    if (pool == NULL) {
+        printf("pool open failed\n");
+        return 1;
+    }
+    mem::pool_resource resource(pool);
+
+    bench_map(std::pmr::get_default_resource(), "map, default resource", elements);
+    bench_map(&resource, "map, pool resource", elements);
+    bench_vectors(std::pmr::get_default_resource(), "vectors, default resource", elements);
+    bench_vectors(&resource, "vectors, pool resource", elements);
+
+    mem_pool_close(pool);
+
+    bench_churn_c();
+    bench_churn_static();
+    mem_free();
+
+    return 0;
+}
@@ -0,0 +1,402 @@
+/*
+ * Cross-process shared memory pools.
+ *
+ * A shared pool lives entirely in a memfd or POSIX shared memory object:
+ *   [header][node table][offset lookup table][pool memory]
+ * All metadata is position-independent (offsets into the pool memory and
+ * node indices), so every process can map the segment at its own address.
+ * Allocations are identified by their offset, which is what the processes
+ * exchange. Operations are serialized by a process-shared robust mutex in
+ * the header.
+ */
+
+#define _GNU_SOURCE // memfd_create, pthread_mutex_consistent
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mem_pool.h"
+
+
+/*************/
+/*           */
+/* Constants */
+/*           */
+/*************/
+static const char       MEM_SHARED_MAGIC[8]             = "MEMSHRD";
+static const uint32_t   MEM_SHARED_VERSION              = 1;
+static const uint32_t   MEM_SHARED_NO_NODE              = 0xFFFFFFFF;
+static const size_t     MEM_SHARED_ALIGN                = 16;   // allocation granularity
+static const size_t     MEM_SHARED_BYTES_PER_NODE       = 256;  // node table sizing
+static const uint32_t   MEM_SHARED_MIN_NODES            = 64;
+
+
+
+/*********************/
+/*                   */
+/* Type declarations */
+/*                   */
+/*********************/
+typedef struct _shared_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t policy;
+    pthread_mutex_t lock;       // PTHREAD_PROCESS_SHARED, robust
+    uint64_t map_size;          // size of the whole segment
+    uint64_t data_offset;       // start of the pool memory in the segment
+    uint64_t total_size;
+    uint64_t alloc_size;
+    uint32_t num_allocs;
+    uint32_t num_gaps;
+    uint32_t node_capacity;
+    uint32_t free_node;         // list of unused nodes, linked through next
+    uint32_t head;              // first segment in address order
+    uint32_t table_mask;        // offset lookup table has table_mask + 1 slots
+} shared_header_t;
+
+typedef struct _shared_node {
+    uint64_t offset;            // from the start of the pool memory
+    uint64_t size;
+    uint32_t next, prev;        // node indices, address order
+    uint32_t allocated;
+    uint32_t padding;
+} shared_node_t;
+
+typedef struct _shared_pool_mgr {
+    shared_pool_t pool;
+    shared_header_t *header;
+    shared_node_t *nodes;
+    uint32_t *table;            // open addressing, offset -> allocated node
+} shared_pool_mgr_t, *shared_pool_mgr_pt;
+
+
+
+/********************************************/
+/*                                          */
+/* Forward declarations of static functions */
+/*                                          */
+/********************************************/
+static shared_pool_pt _mem_shared_map(int fd, const shared_header_t *init);
+static int _mem_shared_lock(shared_header_t *header);
+static uint32_t _mem_shared_hash(const shared_pool_mgr_pt poolMgr, uint64_t offset);
+static void _mem_shared_table_insert(shared_pool_mgr_pt poolMgr, uint32_t node);
+static uint32_t _mem_shared_table_remove(shared_pool_mgr_pt poolMgr, uint64_t offset);
+static uint32_t _mem_shared_new_node(shared_pool_mgr_pt poolMgr);
+static void _mem_shared_free_node(shared_pool_mgr_pt poolMgr, uint32_t node);
+
+
+
+/****************************************/
+/*                                      */
+/* Definitions of user-facing functions */
+/*                                      */
+/****************************************/
+shared_pool_pt mem_shared_pool_create(const char *name, size_t size, alloc_policy policy) {
+	// name is a POSIX shared memory name ("/name"), remove it with shm_unlink;
+	// without a name the pool is an anonymous memfd, shared by fork or fd passing
+	if (size == 0) return NULL;
+	const int fd = name ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)
+	                    : memfd_create("mem_pool_shared", 0);
+	if (fd < 0) return NULL;
+
+	const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	size = (size + MEM_SHARED_ALIGN - 1) & ~(MEM_SHARED_ALIGN - 1);
+	uint32_t nodes = (uint32_t) (size / MEM_SHARED_BYTES_PER_NODE);
+	if (nodes < MEM_SHARED_MIN_NODES) nodes = MEM_SHARED_MIN_NODES;
+	uint32_t slots = 1;
+	while (slots < 2 * nodes) slots <<= 1;
+
+	shared_header_t init;
+	memset(&init, 0, sizeof(init));
+	init.policy = (uint32_t) policy;
+	init.node_capacity = nodes;
+	init.table_mask = slots - 1;
+	init.total_size = size;
+	init.data_offset = (sizeof(shared_header_t) + nodes * sizeof(shared_node_t)
+	                    + slots * sizeof(uint32_t) + page - 1) & ~(page - 1);
+	init.map_size = (init.data_offset + size + page - 1) & ~(page - 1);
+
+	if (ftruncate(fd, (off_t) init.map_size) != 0) {
+		close(fd);
+		if (name) shm_unlink(name);
+		return NULL;
+	}
+	shared_pool_pt pool = _mem_shared_map(fd, &init);
+	if (pool == NULL) {
+		close(fd);
+		if (name) shm_unlink(name);
+	}
+	return pool;
+}
+
+shared_pool_pt mem_shared_pool_attach(const char *name) {
+	if (name == NULL) return NULL;
+	const int fd = shm_open(name, O_RDWR, 0600);
+	if (fd < 0) return NULL;
+	shared_pool_pt pool = _mem_shared_map(fd, NULL);
+	if (pool == NULL) close(fd);
+	return pool;
+}
+
+shared_pool_pt mem_shared_pool_attach_fd(int fd) {
+	const int dupFd = dup(fd); // the pool owns its descriptor
+	if (dupFd < 0) return NULL;
+	shared_pool_pt pool = _mem_shared_map(dupFd, NULL);
+	if (pool == NULL) close(dupFd);
+	return pool;
+}
+
+alloc_status mem_shared_pool_detach(shared_pool_pt pool) {
+	const shared_pool_mgr_pt poolMgr = (shared_pool_mgr_pt) pool;
+	if (poolMgr == NULL) return ALLOC_FAIL;
+	munmap(poolMgr->header, (size_t) poolMgr->header->map_size);
+	close(poolMgr->pool.fd);
+	free(poolMgr);
+	return ALLOC_OK;
+}
+
+size_t mem_shared_alloc(shared_pool_pt pool, size_t size) {
+	const shared_pool_mgr_pt poolMgr = (shared_pool_mgr_pt) pool;
+	if (poolMgr == NULL || size == 0) return MEM_SHARED_NULL;
+	shared_header_t *header = poolMgr->header;
+	shared_node_t *nodes = poolMgr->nodes;
+	size = (size + MEM_SHARED_ALIGN - 1) & ~(MEM_SHARED_ALIGN - 1);
+
+	if (_mem_shared_lock(header) != 0) return MEM_SHARED_NULL;
+	// FIRST_FIT or BEST_FIT walk over the address-ordered node list
+	uint32_t best = MEM_SHARED_NO_NODE;
+	for (uint32_t ix = header->head; ix != MEM_SHARED_NO_NODE; ix = nodes[ix].next) {
+		if (nodes[ix].allocated || nodes[ix].size < size) continue;
+		if (best == MEM_SHARED_NO_NODE || nodes[ix].size < nodes[best].size) best = ix;
+		if (header->policy == FIRST_FIT || nodes[best].size == size) break;
+	}
+	if (best != MEM_SHARED_NO_NODE && nodes[best].size > size) {
+		// split, the remainder stays a gap right after the allocation;
+		// with the node table full the whole gap is handed out instead
+		const uint32_t rest = _mem_shared_new_node(poolMgr);
+		if (rest != MEM_SHARED_NO_NODE) {
+			nodes[rest].offset = nodes[best].offset + size;
+			nodes[rest].size = nodes[best].size - size;
+			nodes[rest].allocated = 0;
+			nodes[rest].prev = best;
+			nodes[rest].next = nodes[best].next;
+			if (nodes[best].next != MEM_SHARED_NO_NODE) nodes[nodes[best].next].prev = rest;
+			nodes[best].next = rest;
+			nodes[best].size = size;
+			header->num_gaps++;
+		}
+	}
+	size_t offset = MEM_SHARED_NULL;
+	if (best != MEM_SHARED_NO_NODE) {
+		nodes[best].allocated = 1;
+		_mem_shared_table_insert(poolMgr, best);
+		header->num_gaps--;
+		header->num_allocs++;
+		header->alloc_size += nodes[best].size;
+		offset = (size_t) nodes[best].offset;
+	}
+	pthread_mutex_unlock(&header->lock);
+	return offset;
+}
+
+alloc_status mem_shared_free(shared_pool_pt pool, size_t offset) {
+	const shared_pool_mgr_pt poolMgr = (shared_pool_mgr_pt) pool;
+	if (poolMgr == NULL) return ALLOC_FAIL;
+	shared_header_t *header = poolMgr->header;
+	shared_node_t *nodes = poolMgr->nodes;
+
+	if (_mem_shared_lock(header) != 0) return ALLOC_FAIL;
+	const uint32_t node = _mem_shared_table_remove(poolMgr, offset);
+	if (node == MEM_SHARED_NO_NODE) {
+		pthread_mutex_unlock(&header->lock);
+		return ALLOC_FAIL;
+	}
+	nodes[node].allocated = 0;
+	header->num_allocs--;
+	header->alloc_size -= nodes[node].size;
+	header->num_gaps++;
+
+	// coalesce with the gaps below and above
+	const uint32_t below = nodes[node].next;
+	if (below != MEM_SHARED_NO_NODE && !nodes[below].allocated) {
+		nodes[node].size += nodes[below].size;
+		nodes[node].next = nodes[below].next;
+		if (nodes[below].next != MEM_SHARED_NO_NODE) nodes[nodes[below].next].prev = node;
+		_mem_shared_free_node(poolMgr, below);
+		header->num_gaps--;
+	}
+	const uint32_t above = nodes[node].prev;
+	if (above != MEM_SHARED_NO_NODE && !nodes[above].allocated) {
+		nodes[above].size += nodes[node].size;
+		nodes[above].next = nodes[node].next;
+		if (nodes[node].next != MEM_SHARED_NO_NODE) nodes[nodes[node].next].prev = above;
+		_mem_shared_free_node(poolMgr, node);
+		header->num_gaps--;
+	}
+	pthread_mutex_unlock(&header->lock);
+	return ALLOC_OK;
+}
+
+char *mem_shared_ptr(shared_pool_pt pool, size_t offset) {
+	if (pool == NULL || offset == MEM_SHARED_NULL || offset >= pool->total_size) return NULL;
+	return pool->mem + offset;
+}
+
+void mem_shared_inspect_pool(shared_pool_pt pool,
+                             pool_segment_pt *segments,
+                             unsigned *num_segments) {
+	const shared_pool_mgr_pt poolMgr = (shared_pool_mgr_pt) pool;
+	*segments = NULL;
+	*num_segments = 0;
+	if (poolMgr == NULL || _mem_shared_lock(poolMgr->header) != 0) return;
+	const shared_node_t *nodes = poolMgr->nodes;
+	const unsigned count = poolMgr->header->num_allocs + poolMgr->header->num_gaps;
+	*segments = (pool_segment_pt) calloc(count ? count : 1, sizeof(pool_segment_t));
+	if (*segments != NULL) {
+		unsigned index = 0;
+		for (uint32_t ix = poolMgr->header->head; ix != MEM_SHARED_NO_NODE && index < count; ix = nodes[ix].next) {
+			(*segments)[index].size = (size_t) nodes[ix].size;
+			(*segments)[index].allocated = nodes[ix].allocated;
+			index++;
+		}
+		*num_segments = index;
+	}
+	pthread_mutex_unlock(&poolMgr->header->lock);
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+static shared_pool_pt _mem_shared_map(int fd, const shared_header_t *init) {
+	// map an existing segment, or lay out a new one when init is given
+	size_t mapSize;
+	if (init) {
+		mapSize = (size_t) init->map_size;
+	} else {
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(shared_header_t)) return NULL;
+		mapSize = (size_t) st.st_size;
+	}
+	shared_header_t *header = (shared_header_t *) mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+	                                                   MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED) return NULL;
+
+	if (init) {
+		*header = *init;
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&header->lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+	} else if (memcmp(header->magic, MEM_SHARED_MAGIC, sizeof(MEM_SHARED_MAGIC)) != 0
+	           || header->version != MEM_SHARED_VERSION
+	           || header->map_size != mapSize) {
+		munmap(header, mapSize);
+		return NULL;
+	}
+
+	const shared_pool_mgr_pt poolMgr = (shared_pool_mgr_pt) calloc(1, sizeof(shared_pool_mgr_t));
+	if (poolMgr == NULL) {
+		munmap(header, mapSize);
+		return NULL;
+	}
+	poolMgr->header = header;
+	poolMgr->nodes = (shared_node_t *) (header + 1);
+	poolMgr->table = (uint32_t *) (poolMgr->nodes + header->node_capacity);
+	poolMgr->pool.mem = (char *) header + header->data_offset;
+	poolMgr->pool.total_size = (size_t) header->total_size;
+	poolMgr->pool.fd = fd;
+
+	if (init) {
+		// one gap spanning the pool, all other nodes unused
+		shared_node_t *nodes = poolMgr->nodes;
+		for (uint32_t ix = 1; ix < header->node_capacity; ix++) {
+			nodes[ix].next = ix + 1 < header->node_capacity ? ix + 1 : MEM_SHARED_NO_NODE;
+		}
+		nodes[0].offset = 0;
+		nodes[0].size = header->total_size;
+		nodes[0].next = MEM_SHARED_NO_NODE;
+		nodes[0].prev = MEM_SHARED_NO_NODE;
+		nodes[0].allocated = 0;
+		header->head = 0;
+		header->free_node = header->node_capacity > 1 ? 1 : MEM_SHARED_NO_NODE;
+		header->num_gaps = 1;
+		memset(poolMgr->table, 0xFF, (header->table_mask + 1) * sizeof(uint32_t));
+		// publish last, attaching processes check the magic
+		header->version = MEM_SHARED_VERSION;
+		memcpy(header->magic, MEM_SHARED_MAGIC, sizeof(MEM_SHARED_MAGIC));
+	}
+	return (shared_pool_pt) poolMgr;
+}
+
+static int _mem_shared_lock(shared_header_t *header) {
+	const int rc = pthread_mutex_lock(&header->lock);
+	if (rc == EOWNERDEAD) {
+		// the owner died holding the lock: recover the mutex so the pool
+		// stays usable, an operation cut short may leave the counters off
+		pthread_mutex_consistent(&header->lock);
+		return 0;
+	}
+	return rc;
+}
+
+static uint32_t _mem_shared_hash(const shared_pool_mgr_pt poolMgr, uint64_t offset) {
+	return (uint32_t) (((offset / MEM_SHARED_ALIGN) * 0x9E3779B97F4A7C15ull) >> 32)
+	       & poolMgr->header->table_mask;
+}
+
+static void _mem_shared_table_insert(shared_pool_mgr_pt poolMgr, uint32_t node) {
+	// the table has twice as many slots as there are nodes, never full
+	const uint32_t mask = poolMgr->header->table_mask;
+	uint32_t slot = _mem_shared_hash(poolMgr, poolMgr->nodes[node].offset);
+	while (poolMgr->table[slot] != MEM_SHARED_NO_NODE) slot = (slot + 1) & mask;
+	poolMgr->table[slot] = node;
+}
+
+static uint32_t _mem_shared_table_remove(shared_pool_mgr_pt poolMgr, uint64_t offset) {
+	const uint32_t mask = poolMgr->header->table_mask;
+	uint32_t *table = poolMgr->table;
+	uint32_t slot = _mem_shared_hash(poolMgr, offset);
+	while (table[slot] != MEM_SHARED_NO_NODE && poolMgr->nodes[table[slot]].offset != offset) {
+		slot = (slot + 1) & mask;
+	}
+	const uint32_t node = table[slot];
+	if (node == MEM_SHARED_NO_NODE) return MEM_SHARED_NO_NODE;
+
+	// backward-shift deletion keeps the probe sequences intact
+	uint32_t hole = slot;
+	for (uint32_t next = (hole + 1) & mask; table[next] != MEM_SHARED_NO_NODE; next = (next + 1) & mask) {
+		const uint32_t home = _mem_shared_hash(poolMgr, poolMgr->nodes[table[next]].offset);
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			table[hole] = table[next];
+			hole = next;
+		}
+	}
+	table[hole] = MEM_SHARED_NO_NODE;
+	return node;
+}
+
+static uint32_t _mem_shared_new_node(shared_pool_mgr_pt poolMgr) {
+	shared_header_t *header = poolMgr->header;
+	const uint32_t node = header->free_node;
+	if (node != MEM_SHARED_NO_NODE) header->free_node = poolMgr->nodes[node].next;
+	return node;
+}
+
+static void _mem_shared_free_node(shared_pool_mgr_pt poolMgr, uint32_t node) {
+	poolMgr->nodes[node].next = poolMgr->header->free_node;
+	poolMgr->nodes[node].prev = MEM_SHARED_NO_NODE;
+	poolMgr->header->free_node = node;
+}
@@ -0,0 +1,193 @@
+/*
+ * A pool whose size classes are fixed at compile time:
+ *
+ *     mem::pool<1 << 20, BEST_FIT, 16, 32, 64, 256> pool;
+ *     void *p = pool.allocate<24>();    // class 32, resolved at compile time
+ *     pool.deallocate<24>(p);
+ *
+ * Requests up to the largest class are served from per-class free lists
+ * carved out of the pool in chunks; the fast path is a table load and a
+ * list pop, all inline. Larger requests, and the chunks, go to
+ * mem_new_alloc: the policy is part of the type, but it is only passed
+ * to the C pool, which applies it at run time like any other. Blocks are
+ * aligned to the pointer size, to max_align_t where the class size is a
+ * multiple of it. An instance is not synchronized, give each thread its own.
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_POOL_STATIC_HPP
+#define DENVER_OS_PA_C_MEM_POOL_STATIC_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "mem_pool.h"
+
+namespace mem {
+
+template <std::size_t Capacity, alloc_policy Policy, std::size_t... SizeClasses>
+class pool {
+public:
+    static constexpr std::size_t num_classes = sizeof...(SizeClasses);
+    static constexpr std::size_t granule = alignof(void *);
+    static constexpr std::array<std::size_t, num_classes + 1> class_sizes = { SizeClasses..., 0 };
+    static constexpr std::size_t max_class_size = num_classes ? class_sizes[num_classes - 1] : 0;
+
+    pool() : pool_(open()) {
+        if (pool_ == nullptr) throw std::bad_alloc();
+    }
+
+    ~pool() {
+        for (std::size_t c = 0; c < num_classes; c++) {
+            while (classes_[c].chunks != nullptr) {
+                const alloc_pt chunk = classes_[c].chunks;
+                std::memcpy(&classes_[c].chunks, chunk->mem, sizeof(alloc_pt));
+                mem_del_alloc(pool_, chunk);
+            }
+        }
+        mem_pool_close(pool_);
+    }
+
+    pool(const pool &) = delete;
+    pool &operator=(const pool &) = delete;
+
+    pool_pt c_pool() const noexcept { return pool_; }
+
+    // the class serving size, num_classes if none does
+    static constexpr std::size_t class_of(std::size_t size) noexcept {
+        return size <= max_class_size ? class_table[(size + granule - 1) / granule] : num_classes;
+    }
+
+    void *allocate(std::size_t size) {
+        const std::size_t c = class_of(size);
+        return c < num_classes ? class_alloc(c) : large_alloc(size);
+    }
+
+    void deallocate(void *p, std::size_t size) noexcept {
+        const std::size_t c = class_of(size);
+        if (c < num_classes) class_free(c, p);
+        else large_free(p);
+    }
+
+    template <std::size_t Size>
+    void *allocate() {
+        constexpr std::size_t c = class_of(Size);
+        if constexpr (c < num_classes) return class_alloc(c);
+        else return large_alloc(Size);
+    }
+
+    template <std::size_t Size>
+    void deallocate(void *p) noexcept {
+        constexpr std::size_t c = class_of(Size);
+        if constexpr (c < num_classes) class_free(c, p);
+        else large_free(p);
+    }
+
+private:
+    static constexpr bool classes_valid() {
+        for (std::size_t c = 0; c < num_classes; c++) {
+            if (class_sizes[c] == 0 || class_sizes[c] % granule != 0) return false;
+            if (c > 0 && class_sizes[c] <= class_sizes[c - 1]) return false;
+        }
+        return true;
+    }
+    static_assert(classes_valid(), "size classes must be ascending multiples of the pointer size");
+    static_assert(num_classes < 256, "at most 255 size classes");
+    static_assert(Capacity > 0, "an empty pool");
+
+    // the pool store may not be set up yet; ALLOC_CALLED_AGAIN if it is
+    static pool_pt open() {
+        mem_init();
+        return mem_pool_open(Capacity, Policy);
+    }
+
+    // class index by size in granules, so a lookup is a single load
+    static constexpr std::array<std::uint8_t, max_class_size / granule + 1> make_class_table() {
+        std::array<std::uint8_t, max_class_size / granule + 1> table{};
+        std::size_t c = 0;
+        for (std::size_t g = 0; g < table.size(); g++) {
+            while (c < num_classes && class_sizes[c] < g * granule) c++;
+            table[g] = static_cast<std::uint8_t>(c);
+        }
+        return table;
+    }
+    static constexpr std::array<std::uint8_t, max_class_size / granule + 1> class_table = make_class_table();
+
+    // a chunk starts with the record of the previous one, so they can all
+    // be given back; its slots follow, aligned to max_align_t
+    static constexpr std::size_t chunk_header = alignof(std::max_align_t) > sizeof(alloc_pt)
+                                                ? alignof(std::max_align_t) : sizeof(alloc_pt);
+    static constexpr std::size_t chunk_bytes = 16 * 1024;
+
+    static constexpr std::size_t chunk_slots(std::size_t c) {
+        return class_sizes[c] * 8 > chunk_bytes ? 8 : chunk_bytes / class_sizes[c];
+    }
+
+    struct size_class {
+        void *free = nullptr;      // freed slots, linked through their first word
+        char *bump = nullptr;      // not yet handed out slots of the newest chunk
+        char *bump_end = nullptr;
+        alloc_pt chunks = nullptr; // newest chunk
+    };
+
+    void *class_alloc(std::size_t c) {
+        size_class &sc = classes_[c];
+        if (sc.free != nullptr) {
+            void *p = sc.free;
+            std::memcpy(&sc.free, p, sizeof(void *));
+            return p;
+        }
+        if (sc.bump == sc.bump_end) add_chunk(c);
+        void *p = sc.bump;
+        sc.bump += class_sizes[c];
+        return p;
+    }
+
+    void class_free(std::size_t c, void *p) noexcept {
+        size_class &sc = classes_[c];
+        std::memcpy(p, &sc.free, sizeof(void *));
+        sc.free = p;
+    }
+
+    void add_chunk(std::size_t c) {
+        size_class &sc = classes_[c];
+        const std::size_t slots = chunk_slots(c);
+        const alloc_pt chunk = mem_new_alloc(pool_, chunk_header + alignof(std::max_align_t) - 1
+                                                    + slots * class_sizes[c]);
+        if (chunk == nullptr) throw std::bad_alloc();
+        std::memcpy(chunk->mem, &sc.chunks, sizeof(alloc_pt));
+        sc.chunks = chunk;
+        const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(chunk->mem) + chunk_header;
+        sc.bump = reinterpret_cast<char *>((first + alignof(std::max_align_t) - 1)
+                                           & ~(std::uintptr_t) (alignof(std::max_align_t) - 1));
+        sc.bump_end = sc.bump + slots * class_sizes[c];
+    }
+
+    // past the classes, the record goes just below the block, as in
+    // pool_resource, so that it can be given back without a search
+    void *large_alloc(std::size_t size) {
+        constexpr std::size_t header = alignof(std::max_align_t);
+        if (size > SIZE_MAX - 2 * header) throw std::bad_alloc();
+        const alloc_pt alloc = mem_new_alloc(pool_, size + 2 * header - 1);
+        if (alloc == nullptr) throw std::bad_alloc();
+        const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(alloc->mem) + header;
+        char *mem = reinterpret_cast<char *>((base + header - 1) & ~(std::uintptr_t) (header - 1));
+        std::memcpy(mem - sizeof(alloc_pt), &alloc, sizeof(alloc_pt));
+        return mem;
+    }
+
+    void large_free(void *p) noexcept {
+        alloc_pt alloc;
+        std::memcpy(&alloc, static_cast<char *>(p) - sizeof(alloc_pt), sizeof(alloc_pt));
+        mem_del_alloc(pool_, alloc);
+    }
+
+    pool_pt pool_;
+    std::array<size_class, num_classes + 1> classes_{};
+};
+
+} // namespace mem
+
+#endif //DENVER_OS_PA_C_MEM_POOL_STATIC_HPP
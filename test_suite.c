@@ -2,8 +2,15 @@
 // Created by Ivo Georgiev on 3/3/16.
 //
 
+#define _POSIX_C_SOURCE 200809L // nanosleep, shm_open
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -114,6 +121,15 @@ static void check_metadata(pool_pt pool,
     assert_true(pool->num_allocs == num_allocs);
     assert_true(pool->num_gaps == num_gaps);
 
+    // the incremental statistics agree
+    pool_stats_t stats;
+    unsigned counted = 0;
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.free_bytes, total_size - alloc_size);
+    assert_int_equal(stats.num_gaps, num_gaps);
+    for (unsigned b = 0; b < MEM_STATS_BUCKETS; b++) counted += stats.gap_histogram[b];
+    assert_int_equal(counted, num_gaps);
+
 #ifdef INSPECT_POOL
     printf("\n\n");
 #endif
@@ -234,6 +250,55 @@ static void test_pool_nonempty(void **state) {
     assert_int_equal(status, ALLOC_OK);
 }
 
+static void test_pool_stable_handles(void **state) {
+    (void) state; /* unused */
+
+    // enough allocations to grow the node heap many times over
+    const unsigned num_allocs = 20000;
+    const size_t alloc_size = 16;
+    alloc_pt *allocs = (alloc_pt *) calloc(num_allocs, sizeof(alloc_pt));
+    alloc_pt first = NULL;
+    assert_non_null(allocs);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(num_allocs * alloc_size, FIRST_FIT);
+    assert_non_null(pool);
+
+    INFO("Allocating %u blocks of %lu bytes\n", num_allocs, (unsigned long) alloc_size);
+    for (unsigned u = 0; u < num_allocs; u++) {
+        allocs[u] = mem_new_alloc(pool, alloc_size);
+        assert_non_null(allocs[u]);
+        memset(allocs[u]->mem, (int) (u & 0x7F), alloc_size);
+        if (u == 0) first = allocs[0];
+        // the first handle never moves, nor does what it says
+        assert_true(allocs[0] == first);
+        assert_true(first->mem == pool->mem);
+        assert_int_equal(first->size, alloc_size);
+    }
+    check_metadata(pool, FIRST_FIT, num_allocs * alloc_size, num_allocs * alloc_size, num_allocs, 0);
+
+    // every handle still describes its own block
+    for (unsigned u = 0; u < num_allocs; u++) {
+        assert_true(allocs[u]->mem == pool->mem + u * alloc_size);
+        assert_int_equal(allocs[u]->size, alloc_size);
+        assert_int_equal(allocs[u]->mem[alloc_size - 1], (char) (u & 0x7F));
+    }
+
+    // and deletes it, in any order
+    for (unsigned u = 0; u < num_allocs; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_FAIL);
+    for (unsigned u = 1; u < num_allocs; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, num_allocs * alloc_size, 0, 0, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+    free(allocs);
+}
+
 
 /*******************************************/
 /***       2. USER-FACING METADATA       ***/
@@ -462,6 +527,453 @@ static void test_pool_bf_metadata(void **state) {
 }
 
 
+static void test_pool_stats(void **state) {
+    (void) state; /* unused */
+
+    pool_stats_t stats;
+    alloc_pt allocs[4];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.free_bytes, POOL_SIZE);
+    assert_int_equal(stats.largest_gap, POOL_SIZE);
+    assert_int_equal(stats.num_gaps, 1);
+    assert_true(stats.fragmentation == 0.0);
+    assert_int_equal(stats.gap_histogram[19], 1); // 2^19 <= 1000000 < 2^20
+
+    // two 100-byte holes in front of the tail gap
+    for (unsigned u = 0; u < 4; u++) {
+        allocs[u] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[u]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.free_bytes, POOL_SIZE - 200);
+    assert_int_equal(stats.largest_gap, POOL_SIZE - 400);
+    assert_int_equal(stats.num_gaps, 3);
+    assert_true(stats.fragmentation > 0.0);
+    assert_true(stats.fragmentation == 1.0 - (double) (POOL_SIZE - 400) / (double) (POOL_SIZE - 200));
+    assert_int_equal(stats.gap_histogram[6], 2);  // 64 <= 100 < 128
+    assert_int_equal(stats.gap_histogram[19], 1);
+
+    // a reused hole leaves its bucket, a merged one too
+    allocs[0] = mem_new_alloc(pool, 100);
+    assert_non_null(allocs[0]);
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK);
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.num_gaps, 1);
+    assert_int_equal(stats.gap_histogram[6], 0);
+    assert_int_equal(stats.largest_gap, POOL_SIZE - 200);
+
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.free_bytes, POOL_SIZE);
+    assert_int_equal(stats.num_gaps, 1);
+    assert_true(stats.fragmentation == 0.0);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static void test_pool_quick_bins(void **state) {
+    (void) state; /* unused */
+
+    pool_options_t options = { .flags = POOL_QUICK_BINS };
+    pool_stats_t stats;
+    alloc_pt allocs[4];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &options);
+    assert_non_null(pool);
+
+    for (unsigned u = 0; u < 3; u++) {
+        allocs[u] = mem_new_alloc(pool, 64);
+        assert_non_null(allocs[u]);
+    }
+
+    // a freed block waits in its bin, and comes back for the same size
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.binned_bytes, 64);
+    assert_int_equal(stats.free_bytes, POOL_SIZE - 128);
+    assert_int_equal(stats.num_gaps, 1);
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_FAIL);
+    alloc_pt again = mem_new_alloc(pool, 64);
+    assert_true(again == allocs[1]);
+    assert_true(again->mem == pool->mem + 64);
+    assert_int_equal(again->size, 64);
+
+    // binned blocks are not gaps until something coalesces them
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    allocs[3] = mem_new_alloc(pool, 32);
+    assert_non_null(allocs[3]);
+    assert_true(allocs[3]->mem == pool->mem + 192);
+
+    // inspecting the pool is one of those things
+    pool_segment_t exp[4] = {
+            { 128, 0 },
+            {  64, 1 },
+            {  32, 1 },
+            { POOL_SIZE - 224, 0 }
+    };
+    check_pool(pool, exp);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 96, 2, 2);
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.binned_bytes, 0);
+
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // a miss coalesces the bins before giving up
+    pool = mem_pool_open_opts(256, FIRST_FIT, &options);
+    assert_non_null(pool);
+    for (unsigned u = 0; u < 4; u++) {
+        allocs[u] = mem_new_alloc(pool, 64);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 0; u < 4; u++) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    assert_int_equal(pool->num_gaps, 0);
+    alloc_pt large = mem_new_alloc(pool, 200);
+    assert_non_null(large);
+    assert_true(large->mem == pool->mem);
+    assert_int_equal(mem_del_alloc(pool, large), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, 256, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // and so do too many binned bytes
+    const unsigned num_allocs = 5000;
+    alloc_pt *many = (alloc_pt *) calloc(num_allocs, sizeof(alloc_pt));
+    assert_non_null(many);
+    pool = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &options);
+    assert_non_null(pool);
+    for (unsigned u = 0; u < num_allocs; u++) {
+        many[u] = mem_new_alloc(pool, 100);
+        assert_non_null(many[u]);
+    }
+    for (unsigned u = 0; u < num_allocs; u++) {
+        assert_int_equal(mem_del_alloc(pool, many[u]), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_true(stats.binned_bytes < num_allocs * 100);
+    assert_true(stats.num_gaps >= 1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    free(many);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static void test_pool_small_objects(void **state) {
+    (void) state; /* unused */
+
+    pool_options_t options = { .flags = POOL_SMALL_OBJECTS };
+    const unsigned num_allocs = 300; // a few slabs' worth
+    alloc_pt allocs[300];
+    unsigned num_segments = 0;
+    pool_segment_pt segs = NULL;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open_opts(POOL_SIZE, BEST_FIT, &options);
+    assert_non_null(pool);
+
+    // same-class objects sit next to each other in one slab, which is
+    // a single allocated segment of the pool
+    for (unsigned u = 0; u < num_allocs; u++) {
+        allocs[u] = mem_new_alloc(pool, 20);
+        assert_non_null(allocs[u]);
+        assert_int_equal(allocs[u]->size, 20);
+    }
+    assert_true(allocs[1]->mem == allocs[0]->mem + 24);
+    assert_true(allocs[0]->mem == pool->mem);
+    assert_int_equal(pool->num_allocs, num_allocs);
+    assert_int_equal(pool->alloc_size, num_allocs * 20);
+    mem_inspect_pool(pool, &segs, &num_segments);
+    assert_int_equal(num_segments, 4); // three slabs and the tail gap
+    assert_int_equal(segs[0].allocated, 1);
+    free(segs);
+
+    // a freed slot is the next one handed out, and is looked up by address
+    char *mem = allocs[7]->mem;
+    assert_true(mem_find_alloc(pool, mem) == allocs[7]);
+    assert_null(mem_find_alloc(pool, mem + 1));
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_FAIL);
+    assert_null(mem_find_alloc(pool, mem));
+    allocs[7] = mem_new_alloc(pool, 17);
+    assert_non_null(allocs[7]);
+    assert_true(allocs[7]->mem == mem);
+
+    // larger requests and handles still get nodes of their own
+    alloc_pt large = mem_new_alloc(pool, 65);
+    alloc_pt handle = mem_new_handle(pool, 8);
+    assert_non_null(large);
+    assert_non_null(handle);
+    assert_true(mem_find_alloc(pool, large->mem) == large);
+
+    // live objects keep the pool open
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    for (unsigned u = 0; u < num_allocs; u++) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    assert_int_equal(mem_del_alloc(pool, large), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, handle), ALLOC_OK);
+    assert_int_equal(pool->num_allocs, 0);
+    assert_int_equal(pool->alloc_size, 0);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static void test_pool_scalar_scan(void **state) {
+    (void) state; /* unused */
+
+    // best fit picks the same gap whether or not its scan is vectorized,
+    // over several chunks of nodes and a ragged last one
+    const unsigned num_allocs = 701;
+    const unsigned flags[2] = { 0, POOL_SCALAR_SCAN };
+    size_t offsets[2];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    alloc_pt *allocs = (alloc_pt *) calloc(num_allocs, sizeof(alloc_pt));
+    assert_non_null(allocs);
+    for (unsigned f = 0; f < 2; f++) {
+        pool_options_t options = { .flags = flags[f] };
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, BEST_FIT, &options);
+        assert_non_null(pool);
+        for (unsigned u = 0; u < num_allocs; u++) {
+            allocs[u] = mem_new_alloc(pool, 8 + (u * 7) % 50);
+            assert_non_null(allocs[u]);
+        }
+        for (unsigned u = 0; u < num_allocs; u += 3) {
+            assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+        }
+        alloc_pt fit = mem_new_alloc(pool, 40);
+        assert_non_null(fit);
+        assert_int_equal(fit->size, 40);
+        offsets[f] = (size_t) (fit->mem - pool->mem);
+        assert_int_equal(mem_del_alloc(pool, fit), ALLOC_OK);
+        for (unsigned u = 1; u < num_allocs; u++) {
+            if (u % 3) assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+        }
+        check_metadata(pool, BEST_FIT, POOL_SIZE, 0, 0, 1);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+    assert_int_equal(offsets[0], offsets[1]);
+    assert_true(offsets[0] < POOL_SIZE / 2); // a hole, not the tail gap
+    free(allocs);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_node_reuse(void **state) {
+    (void) state; /* unused */
+
+    // allocation records of freed blocks are handed out again, so churn
+    // around a long-lived block cycles through the same few of them
+    const unsigned num_cycles = 100000;
+    alloc_pt seen[8] = { NULL };
+    unsigned num_seen = 0;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    alloc_pt live = mem_new_alloc(pool, 100);
+    assert_non_null(live);
+    for (unsigned u = 0; u < num_cycles; u++) {
+        alloc_pt pair[2];
+        for (unsigned p = 0; p < 2; p++) {
+            pair[p] = mem_new_alloc(pool, 100 + (u + p) % 200);
+            assert_non_null(pair[p]);
+            unsigned s = 0;
+            while (s < num_seen && seen[s] != pair[p]) s++;
+            if (s == num_seen) {
+                assert_true(num_seen < 8);
+                seen[num_seen++] = pair[p];
+            }
+        }
+        assert_int_equal(mem_del_alloc(pool, pair[u % 2]), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, pair[1 - u % 2]), ALLOC_OK);
+    }
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 100, 1, 1);
+
+    // a burst spanning many chunks of nodes, freed from the top so that
+    // they empty and are given back, then allocated again
+    const unsigned num_burst = 3000;
+    alloc_pt *burst = (alloc_pt *) calloc(num_burst, sizeof(alloc_pt));
+    assert_non_null(burst);
+    for (unsigned r = 0; r < 2; r++) {
+        for (unsigned u = 0; u < num_burst; u++) {
+            burst[u] = mem_new_alloc(pool, 64);
+            assert_non_null(burst[u]);
+        }
+        check_metadata(pool, BEST_FIT, POOL_SIZE, 100 + num_burst * 64, num_burst + 1, 1);
+        for (unsigned u = num_burst; u-- > 0; ) {
+            assert_int_equal(mem_del_alloc(pool, burst[u]), ALLOC_OK);
+        }
+        check_metadata(pool, BEST_FIT, POOL_SIZE, 100, 1, 1);
+    }
+    free(burst);
+
+    assert_int_equal(mem_del_alloc(pool, live), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_large_allocs(void **state) {
+    (void) state; /* unused */
+
+    pool_options_t options = { .large_threshold = POOL_SIZE / 4 };
+    pool_segment_pt segs = NULL;
+    unsigned num_segments = 0;
+    pool_stats_t stats;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &options);
+    assert_non_null(pool);
+
+    // above the threshold, nothing is carved from the pool
+    alloc_pt small = mem_new_alloc(pool, 100);
+    alloc_pt large = mem_new_alloc(pool, POOL_SIZE / 2);
+    alloc_pt larger = mem_new_alloc(pool, POOL_SIZE * 2);
+    assert_non_null(small);
+    assert_non_null(large);
+    assert_non_null(larger);
+    assert_true(large->mem < pool->mem || large->mem >= pool->mem + POOL_SIZE);
+    assert_int_equal(large->size, POOL_SIZE / 2);
+    memset(larger->mem, 0xA5, POOL_SIZE * 2);
+    assert_int_equal(pool->num_allocs, 3);
+    assert_int_equal(pool->alloc_size, 100 + POOL_SIZE / 2 + POOL_SIZE * 2);
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.free_bytes, POOL_SIZE - 100);
+    assert_true(mem_find_alloc(pool, large->mem) == large);
+
+    // but they are in the pool's inventory, after its own segments
+    mem_inspect_pool(pool, &segs, &num_segments);
+    assert_int_equal(num_segments, 4);
+    assert_int_equal(segs[0].size, 100);
+    assert_int_equal(segs[1].allocated, 0);
+    assert_int_equal(segs[2].size, POOL_SIZE / 2);
+    assert_int_equal(segs[2].allocated, 1);
+    assert_int_equal(segs[3].size, POOL_SIZE * 2);
+    free(segs);
+
+    // and gone from it, mapping and all, once freed
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(pool, large), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, larger), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, small), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_auto_fit(void **state) {
+    (void) state; /* unused */
+
+    const unsigned window = 1024; // allocations between choices
+    const unsigned num_allocs = 1800;
+    alloc_pt *allocs = (alloc_pt *) calloc(num_allocs, sizeof(alloc_pt));
+    pool_stats_t stats;
+
+    assert_non_null(allocs);
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, AUTO_FIT);
+    assert_non_null(pool);
+    assert_int_equal(pool->policy, AUTO_FIT);
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.fit, FIRST_FIT);
+    assert_int_equal(stats.quick_bins, 0);
+
+    // small blocks freed right away: segregated into quick bins
+    for (unsigned u = 0; u < 2 * window; u++) {
+        alloc_pt alloc = mem_new_alloc(pool, 32);
+        assert_non_null(alloc);
+        assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.fit, FIRST_FIT);
+    assert_int_equal(stats.quick_bins, 1);
+
+    // long-lived larger blocks: no more bins, and every other one freed
+    // leaves holes that nothing larger fits in
+    for (unsigned u = 0; u < num_allocs; u++) {
+        allocs[u] = mem_new_alloc(pool, 512);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 0; u < num_allocs; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.quick_bins, 0);
+    assert_int_equal(stats.binned_bytes, 0);
+    assert_true(stats.fragmentation > 0.5);
+
+    // so the next window goes best fit
+    for (unsigned u = 0; u < window; u++) {
+        alloc_pt alloc = mem_new_alloc(pool, 1000);
+        assert_non_null(alloc);
+        assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.fit, BEST_FIT);
+    check_metadata(pool, AUTO_FIT, POOL_SIZE, num_allocs / 2 * 512, num_allocs / 2, num_allocs / 2 + 1);
+
+    // and back to first fit once the holes are gone
+    for (unsigned u = 1; u < num_allocs; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    for (unsigned u = 0; u < window; u++) {
+        alloc_pt alloc = mem_new_alloc(pool, 1000);
+        assert_non_null(alloc);
+        assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.fit, FIRST_FIT);
+    check_metadata(pool, AUTO_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // large allocations are mapped apart and sampled on neither side, so
+    // freeing many of them doesn't hide the short-lived small blocks
+    pool_options_t options = { .large_threshold = 4096 };
+    pool = mem_pool_open_opts(POOL_SIZE, AUTO_FIT, &options);
+    assert_non_null(pool);
+    alloc_pt *large = (alloc_pt *) calloc(4 * window, sizeof(alloc_pt));
+    assert_non_null(large);
+    for (unsigned u = 0; u < 4 * window; u++) {
+        large[u] = mem_new_alloc(pool, 8192);
+        assert_non_null(large[u]);
+    }
+    for (unsigned u = 0; u < 2 * window; u++) {
+        alloc_pt alloc = mem_new_alloc(pool, 32);
+        assert_non_null(alloc);
+        assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, large[2 * u]), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, large[2 * u + 1]), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.quick_bins, 1);
+    free(large);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+    free(allocs);
+}
+
 /*******************************************/
 /***       3. FIRST_FIT SCENARIOS        ***/
 /*******************************************/
@@ -2408,18 +2920,938 @@ void test_pool_stresstest(void **state) {
 
 
 /*******************************************/
-/***         6. DRIVER ROUTINE           ***/
+/***          6. OBJECT CACHES           ***/
+/*******************************************/
+
+typedef struct _cache_obj {
+    unsigned magic;
+    unsigned uses;
+    char payload[56];
+} cache_obj_t;
+
+static const unsigned CACHE_OBJ_MAGIC = 0xCAC4E;
+static unsigned cache_ctor_calls = 0;
+static unsigned cache_dtor_calls = 0;
+
+static void cache_obj_ctor(void *obj) {
+    ((cache_obj_t *) obj)->magic = CACHE_OBJ_MAGIC;
+    ((cache_obj_t *) obj)->uses = 0;
+    cache_ctor_calls++;
+}
+
+static void cache_obj_dtor(void *obj) {
+    assert_int_equal(((cache_obj_t *) obj)->magic, CACHE_OBJ_MAGIC);
+    cache_dtor_calls++;
+}
+
+static void test_cache_reuse(void **state) {
+    pool_pt pool = *state;
+    const unsigned num_objs = 1000;
+    cache_obj_t **objs = calloc(num_objs, sizeof(cache_obj_t *));
+    assert_non_null(objs);
+
+    cache_ctor_calls = cache_dtor_calls = 0;
+    cache_pt cache = mem_cache_create(pool, sizeof(cache_obj_t), 64, cache_obj_ctor, cache_obj_dtor);
+    assert_non_null(cache);
+
+    INFO("Allocating %u cached objects\n", num_objs);
+    for (unsigned u = 0; u < num_objs; u++) {
+        objs[u] = mem_cache_alloc(cache);
+        assert_non_null(objs[u]);
+        assert_int_equal((size_t) objs[u] % 64, 0);
+        assert_int_equal(objs[u]->magic, CACHE_OBJ_MAGIC);
+        objs[u]->uses++;
+    }
+    assert_int_equal(cache->num_objs, num_objs);
+    assert_true(cache->num_slabs > 1);
+    assert_true(cache_ctor_calls >= num_objs);
+
+    // a freed object comes back already constructed, with its state intact
+    const unsigned ctor_calls = cache_ctor_calls;
+    cache_obj_t *reused = objs[num_objs / 2];
+    assert_int_equal(mem_cache_free(cache, reused), ALLOC_OK);
+    objs[num_objs / 2] = mem_cache_alloc(cache);
+    assert_true(objs[num_objs / 2] == reused);
+    assert_int_equal(reused->uses, 1);
+    assert_int_equal(cache_ctor_calls, ctor_calls);
+
+    // completely free slabs go back to the pool
+    INFO("Freeing all cached objects\n");
+    for (unsigned u = 0; u < num_objs; u++) {
+        assert_int_equal(mem_cache_free(cache, objs[u]), ALLOC_OK);
+    }
+    assert_int_equal(cache->num_objs, 0);
+    assert_true(cache->num_slabs <= 1);
+    assert_true(pool->num_allocs <= 1);
+
+    assert_int_equal(mem_cache_destroy(cache), ALLOC_OK);
+    assert_int_equal(cache_dtor_calls, cache_ctor_calls);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    free(objs);
+}
+
+static void test_cache_large_slabs(void **state) {
+    (void) state; /* unused */
+
+    // slabs above the pool's large threshold are mapped apart, and still
+    // go back to it when the cache is destroyed
+    pool_options_t options = { .large_threshold = 4096 };
+    void *objs[64];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &options);
+    assert_non_null(pool);
+    cache_pt cache = mem_cache_create(pool, 2048, 64, NULL, NULL);
+    assert_non_null(cache);
+    for (unsigned u = 0; u < 64; u++) {
+        objs[u] = mem_cache_alloc(cache);
+        assert_non_null(objs[u]);
+    }
+    assert_true(pool->alloc_size > 64 * 2048);
+    for (unsigned u = 0; u < 64; u++) {
+        assert_int_equal(mem_cache_free(cache, objs[u]), ALLOC_OK);
+    }
+    assert_int_equal(mem_cache_destroy(cache), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+/*******************************************/
+/***     7. PAGE BACKING AND RELEASE     ***/
+/*******************************************/
+
+static size_t resident_bytes(void) {
+    unsigned long size = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    assert_non_null(statm);
+    assert_int_equal(fscanf(statm, "%lu %lu", &size, &resident), 2);
+    fclose(statm);
+
+    return (size_t) resident * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+static void test_pool_release_rss(void **state) {
+    (void) state; /* unused */
+
+    const unsigned num_allocs = 16;
+    const size_t alloc_size = 4 * 1024 * 1024;
+    alloc_pt allocs[16];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(num_allocs * alloc_size, FIRST_FIT);
+    assert_non_null(pool);
+
+    // burst to full occupancy, touching every page
+    for (unsigned u = 0; u < num_allocs; u++) {
+        allocs[u] = mem_new_alloc(pool, alloc_size);
+        assert_non_null(allocs[u]);
+        memset(allocs[u]->mem, 0x5A, alloc_size);
+    }
+    const size_t rss_full = resident_bytes();
+
+    // drain, the coalesced gaps give their pages back
+    for (unsigned u = 0; u < num_allocs; u++) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    const size_t rss_drained = resident_bytes();
+    INFO("RSS full %lu KiB, drained %lu KiB\n",
+         (unsigned long) rss_full / 1024, (unsigned long) rss_drained / 1024);
+
+    assert_true(rss_drained + num_allocs * alloc_size / 2 < rss_full);
+    assert_int_equal(pool->num_gaps, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_huge_pages(void **state) {
+    (void) state; /* unused */
+
+    const size_t pool_size = 8 * 1024 * 1024;
+    pool_options_t options = { .flags = POOL_HUGE_PAGES };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    INFO("Allocating pool of %lu bytes backed by huge pages\n", (unsigned long) pool_size);
+    pool_pt pool = mem_pool_open_opts(pool_size, BEST_FIT, &options);
+    assert_non_null(pool);
+    check_metadata(pool, BEST_FIT, pool_size, 0, 0, 1);
+
+    // falls back to normal pages silently, either way the memory is usable
+    alloc_pt alloc0 = mem_new_alloc(pool, pool_size / 2);
+    assert_non_null(alloc0);
+    memset(alloc0->mem, 0xA5, pool_size / 2);
+    alloc_pt alloc1 = mem_new_alloc(pool, pool_size / 2);
+    assert_non_null(alloc1);
+    memset(alloc1->mem, 0x5A, pool_size / 2);
+    check_metadata(pool, BEST_FIT, pool_size, pool_size, 2, 0);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    check_metadata(pool, BEST_FIT, pool_size, 0, 0, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_growable(void **state) {
+    (void) state; /* unused */
+
+    const size_t pool_size = 64 * 1024;
+    const size_t reserve_size = 64 * 1024 * 1024;
+    const size_t alloc_size = 1024 * 1024;
+    pool_options_t options = { .flags = POOL_GROWABLE, .reserve_size = reserve_size };
+    alloc_pt allocs[16];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    INFO("Allocating growable pool of %lu bytes, reserving %lu\n",
+         (unsigned long) pool_size, (unsigned long) reserve_size);
+    pool_pt pool = mem_pool_open_opts(pool_size, FIRST_FIT, &options);
+    assert_non_null(pool);
+    check_metadata(pool, FIRST_FIT, pool_size, 0, 0, 1);
+    char *const mem = pool->mem;
+
+    // grows past the committed size, the pool doesn't move
+    for (unsigned u = 0; u < 16; u++) {
+        allocs[u] = mem_new_alloc(pool, alloc_size);
+        assert_non_null(allocs[u]);
+        memset(allocs[u]->mem, (int) u, alloc_size);
+    }
+    assert_true(pool->mem == mem);
+    assert_true(pool->total_size >= 16 * alloc_size);
+    assert_true(pool->total_size <= reserve_size);
+    assert_int_equal(pool->alloc_size, 16 * alloc_size);
+    for (unsigned u = 0; u < 16; u++) {
+        assert_true(allocs[u]->mem >= mem && allocs[u]->mem < mem + pool->total_size);
+        assert_int_equal(allocs[u]->mem[alloc_size - 1], (char) u);
+    }
+
+    // but not past the reservation
+    assert_null(mem_new_alloc(pool, reserve_size));
+
+    const size_t total_size = pool->total_size;
+    for (unsigned u = 0; u < 16; u++) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, total_size, 0, 0, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_prefault(void **state) {
+    (void) state; /* unused */
+
+    const size_t pool_size = 32 * 1024 * 1024;
+    const unsigned num_allocs = 5000;
+    const size_t alloc_size = 64;
+    // with capacity hints for the node heap and gap index
+    pool_options_t options = { .flags = POOL_PREFAULT,
+                               .expected_allocs = num_allocs,
+                               .expected_gaps = num_allocs / 2 };
+    alloc_pt allocs[5000];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    const size_t rss_before = resident_bytes();
+    pool_pt pool = mem_pool_open_opts(pool_size, FIRST_FIT, &options);
+    assert_non_null(pool);
+    const size_t rss_open = resident_bytes();
+    INFO("RSS before %lu KiB, after prefaulted open %lu KiB\n",
+         (unsigned long) rss_before / 1024, (unsigned long) rss_open / 1024);
+
+    // the pages are resident before anything is allocated
+    assert_true(rss_open >= rss_before + pool_size / 4 * 3);
+    check_metadata(pool, FIRST_FIT, pool_size, 0, 0, 1);
+
+    // a burst up to the hinted counts
+    for (unsigned u = 0; u < num_allocs; u++) {
+        allocs[u] = mem_new_alloc(pool, alloc_size);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 0; u < num_allocs; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, pool_size, num_allocs / 2 * alloc_size, num_allocs / 2, num_allocs / 2 + 1);
+    for (unsigned u = 1; u < num_allocs; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, pool_size, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // growth prefaults the pages it commits, too
+    options.flags = POOL_PREFAULT | POOL_GROWABLE;
+    options.reserve_size = 4 * pool_size;
+    pool = mem_pool_open_opts(64 * 1024, FIRST_FIT, &options);
+    assert_non_null(pool);
+    const size_t rss_small = resident_bytes();
+    alloc_pt alloc = mem_new_alloc(pool, pool_size);
+    assert_non_null(alloc);
+    assert_true(resident_bytes() >= rss_small + pool_size / 4 * 3);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_trim(void **state) {
+    (void) state; /* unused */
+
+    const size_t mb = 1024 * 1024;
+    const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    pool_options_t growable = { .flags = POOL_GROWABLE, .reserve_size = 64 * mb };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(64 * mb, FIRST_FIT);
+    pool_pt grown = mem_pool_open_opts(mb, BEST_FIT, &growable);
+    assert_non_null(pool);
+    assert_non_null(grown);
+
+    // the tail gap is cut down to keep_bytes (rounded up to a page)
+    alloc_pt alloc0 = mem_new_alloc(pool, mb);
+    assert_non_null(alloc0);
+    memset(alloc0->mem, 0x11, mb);
+    assert_int_equal(mem_pool_trim(pool, page), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, mb + page, mb, 1, 1);
+    assert_int_equal(alloc0->mem[mb - 1], 0x11);
+    assert_null(mem_new_alloc(pool, 2 * page));
+
+    // or removed entirely
+    assert_int_equal(mem_pool_trim(pool, 0), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, mb, mb, 1, 0);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_trim(pool, 0), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, page, 0, 0, 1);
+
+    // a trimmed growable pool grows back into its reservation
+    alloc_pt alloc1 = mem_new_alloc(grown, 16 * mb);
+    assert_non_null(alloc1);
+    char *const mem = grown->mem;
+    assert_int_equal(mem_del_alloc(grown, alloc1), ALLOC_OK);
+    assert_int_equal(mem_pool_trim(grown, 0), ALLOC_OK);
+    check_metadata(grown, BEST_FIT, page, 0, 0, 1);
+    alloc1 = mem_new_alloc(grown, 32 * mb);
+    assert_non_null(alloc1);
+    assert_true(grown->mem == mem);
+    memset(alloc1->mem, 0x22, 32 * mb);
+    assert_int_equal(mem_del_alloc(grown, alloc1), ALLOC_OK);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_close(grown), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_scavenger(void **state) {
+    (void) state; /* unused */
+
+    const size_t pool_size = 64 * 1024 * 1024;
+    scavenger_options_t options = { 10, 30, 16 * 1024 * 1024 };
+    scavenger_stats_t stats;
+    const struct timespec tick = { 0, 10 * 1000 * 1000 };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(pool_size, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_scavenger_start(&options), ALLOC_OK);
+    assert_int_equal(mem_scavenger_start(&options), ALLOC_CALLED_AGAIN);
+
+    alloc_pt alloc = mem_new_alloc(pool, pool_size);
+    assert_non_null(alloc);
+    memset(alloc->mem, 0x5A, pool_size);
+    const size_t rss_full = resident_bytes();
+
+    // the free itself doesn't release anything, the scavenger does, later
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    for (unsigned tries = 0; tries < 500; tries++) {
+        mem_scavenger_stats(&stats);
+        if (stats.gaps_released > 0) break;
+        nanosleep(&tick, NULL);
+    }
+    const size_t rss_scavenged = resident_bytes();
+    INFO("RSS full %lu KiB, scavenged %lu KiB after %lu passes\n",
+         (unsigned long) rss_full / 1024, (unsigned long) rss_scavenged / 1024, stats.passes);
+
+    assert_int_equal(stats.gaps_released, 1);
+    assert_true(stats.bytes_released >= pool_size - 4096);
+    // 64 MiB at 16 MiB per pass
+    assert_true(stats.throttled_passes >= 3);
+    assert_true(rss_scavenged + pool_size / 2 < rss_full);
+
+    assert_int_equal(mem_scavenger_stop(), ALLOC_OK);
+    assert_int_equal(mem_scavenger_stop(), ALLOC_CALLED_AGAIN);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+/*******************************************/
+/***        8. PERSISTENT POOLS          ***/
+/*******************************************/
+
+static void test_pool_file_reopen(void **state) {
+    (void) state; /* unused */
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mem_pool_test_%d.pool", (int) getpid());
+    unlink(path);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    INFO("Allocating persistent pool of %lu bytes in %s\n", (long) POOL_SIZE, path);
+    pool_pt pool = mem_pool_open_file(path, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 1000);
+    alloc_pt alloc2 = mem_new_alloc(pool, 10000);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    const size_t offset2 = (size_t) (alloc2->mem - pool->mem);
+    strcpy(alloc0->mem, "root");
+    strcpy(alloc2->mem, "survives a restart");
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    // close with live allocations, as a process would on shutdown
+    INFO("Closing persistent pool with live allocations\n");
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    INFO("Reopening persistent pool\n");
+    pool = mem_pool_open_file(path, 0, FIRST_FIT);
+    assert_non_null(pool);
+
+    pool_segment_t exp[4] =
+            {
+                    {100, 1},
+                    {1000, 0},
+                    {10000, 1},
+                    {POOL_SIZE - 100 - 1000 - 10000, 0}
+            };
+    check_pool(pool, exp);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 10100, 2, 2);
+    assert_string_equal(pool->mem, "root");
+    assert_string_equal(pool->mem + offset2, "survives a restart");
+
+    // the allocator resumes where it left off
+    alloc1 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc1);
+    assert_true(alloc1->mem == pool->mem + 100);
+
+    alloc0 = mem_find_alloc(pool, pool->mem);
+    alloc2 = mem_find_alloc(pool, pool->mem + offset2);
+    assert_non_null(alloc0);
+    assert_non_null(alloc2);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+    unlink(path);
+
+    // an AUTO_FIT pool file never bins freed blocks, they would be
+    // persisted as allocations
+    pool_stats_t stats;
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool = mem_pool_open_file(path, POOL_SIZE, AUTO_FIT);
+    assert_non_null(pool);
+    for (unsigned u = 0; u < 2048; u++) {
+        alloc0 = mem_new_alloc(pool, 32);
+        assert_non_null(alloc0);
+        assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.quick_bins, 0);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    pool = mem_pool_open_file(path, 0, AUTO_FIT);
+    assert_non_null(pool);
+    check_metadata(pool, AUTO_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // handles are still movable after a reopen
+    pool = mem_pool_open_file(path, 0, FIRST_FIT);
+    assert_non_null(pool);
+    alloc0 = mem_new_alloc(pool, 100);
+    alloc1 = mem_new_handle(pool, 1000);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    strcpy(alloc1->mem, "moves");
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    pool = mem_pool_open_file(path, 0, FIRST_FIT);
+    assert_non_null(pool);
+    alloc1 = mem_find_alloc(pool, pool->mem + 100);
+    assert_non_null(alloc1);
+    assert_int_equal(mem_pool_compact(pool, 0), 1000);
+    assert_true(alloc1->mem == pool->mem);
+    assert_string_equal(alloc1->mem, "moves");
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // and a file whose tables don't add up is refused: the gap table is
+    // last, its last word a node index
+    FILE *file = fopen(path, "r+b");
+    const unsigned long long badNode = 12345;
+    assert_non_null(file);
+    assert_int_equal(fseek(file, -(long) sizeof(badNode), SEEK_END), 0);
+    assert_int_equal(fwrite(&badNode, sizeof(badNode), 1, file), 1);
+    assert_int_equal(fclose(file), 0);
+    assert_null(mem_pool_open_file(path, 0, FIRST_FIT));
+    assert_int_equal(truncate(path, 8192), 0);
+    assert_null(mem_pool_open_file(path, 0, FIRST_FIT));
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+    unlink(path);
+}
+
+
+/*******************************************/
+/***       9. SHARED MEMORY POOLS        ***/
+/*******************************************/
+
+static void test_shared_pool_handoff(void **state) {
+    (void) state; /* unused */
+
+    char name[64];
+    snprintf(name, sizeof(name), "/mem_pool_test_%d", (int) getpid());
+
+    INFO("Creating shared pool %s of %lu bytes\n", name, (long) POOL_SIZE);
+    shared_pool_pt pool = mem_shared_pool_create(name, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    // a mailbox at a well-known offset, and a record to hand off
+    const size_t mailbox = mem_shared_alloc(pool, sizeof(size_t));
+    const size_t record = mem_shared_alloc(pool, 1000);
+    assert_int_equal(mailbox, 0);
+    assert_int_not_equal(record, MEM_SHARED_NULL);
+    strcpy(mem_shared_ptr(pool, record), "ingested record");
+    *(size_t *) mem_shared_ptr(pool, mailbox) = MEM_SHARED_NULL;
+
+    pid_t child = fork();
+    assert_true(child >= 0);
+    if (child == 0) {
+        // the consumer maps the pool on its own and works with offsets only
+        shared_pool_pt view = mem_shared_pool_attach(name);
+        int ok = view != NULL
+                 && strcmp(mem_shared_ptr(view, record), "ingested record") == 0
+                 && mem_shared_free(view, record) == ALLOC_OK;
+        const size_t reply = ok ? mem_shared_alloc(view, 100) : MEM_SHARED_NULL;
+        if (reply != MEM_SHARED_NULL) {
+            strcpy(mem_shared_ptr(view, reply), "query result");
+            *(size_t *) mem_shared_ptr(view, mailbox) = reply;
+        }
+        if (view) mem_shared_pool_detach(view);
+        _exit(reply != MEM_SHARED_NULL ? 0 : 1);
+    }
+    int status = -1;
+    assert_int_equal(waitpid(child, &status, 0), child);
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), 0);
+
+    // the child freed the record and allocated its reply in its place
+    const size_t reply = *(size_t *) mem_shared_ptr(pool, mailbox);
+    assert_int_equal(reply, record);
+    assert_string_equal(mem_shared_ptr(pool, reply), "query result");
+
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+    mem_shared_inspect_pool(pool, &segs, &num_segs);
+    assert_non_null(segs);
+    assert_int_equal(num_segs, 3);
+    assert_int_equal(segs[1].size, 112);
+    assert_int_equal(segs[1].allocated, 1);
+    assert_int_equal(segs[2].allocated, 0);
+    free(segs);
+
+    assert_int_equal(mem_shared_free(pool, reply), ALLOC_OK);
+    assert_int_equal(mem_shared_free(pool, mailbox), ALLOC_OK);
+    assert_int_equal(mem_shared_free(pool, mailbox), ALLOC_FAIL);
+    mem_shared_inspect_pool(pool, &segs, &num_segs);
+    assert_int_equal(num_segs, 1);
+    assert_int_equal(segs[0].allocated, 0);
+    free(segs);
+
+    assert_int_equal(mem_shared_pool_detach(pool), ALLOC_OK);
+    shm_unlink(name);
+}
+
+static void test_shared_pool_node_table_full(void **state) {
+    (void) state; /* unused */
+
+    // a small anonymous pool gets the minimum node table of 64 nodes
+    shared_pool_pt pool = mem_shared_pool_create(NULL, 4096, FIRST_FIT);
+    assert_non_null(pool);
+
+    // 63 allocations split the pool into 64 segments, which fills the table
+    for (unsigned i = 0; i < 63; ++i) {
+        assert_int_equal(mem_shared_alloc(pool, 16), i * 16);
+    }
+
+    // the next one can't split the last gap, so it gets all of it
+    const size_t last = mem_shared_alloc(pool, 16);
+    assert_int_equal(last, 63 * 16);
+    assert_int_equal(mem_shared_alloc(pool, 16), MEM_SHARED_NULL);
+
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+    mem_shared_inspect_pool(pool, &segs, &num_segs);
+    assert_non_null(segs);
+    assert_int_equal(num_segs, 64);
+    assert_int_equal(segs[63].size, 4096 - 63 * 16);
+    assert_int_equal(segs[63].allocated, 1);
+    free(segs);
+
+    // freeing it gives the whole gap back
+    assert_int_equal(mem_shared_free(pool, last), ALLOC_OK);
+    assert_int_equal(mem_shared_alloc(pool, 4096 - 63 * 16), last);
+
+    assert_int_equal(mem_shared_pool_detach(pool), ALLOC_OK);
+}
+
+
+/*******************************************/
+/***          10. NUMA PLACEMENT          ***/
+/*******************************************/
+
+static void test_pool_numa(void **state) {
+    (void) state; /* unused */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // placement is best effort, so this passes on single-node machines too
+    pool_options_t bind = { .flags = POOL_NUMA_BIND, .numa_node = 0 };
+    pool_options_t interleave = { .flags = POOL_NUMA_INTERLEAVE };
+    pool_pt pools[2];
+    pools[0] = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &bind);
+    pools[1] = mem_pool_open_opts(POOL_SIZE, BEST_FIT, &interleave);
+    for (unsigned p = 0; p < 2; p++) {
+        assert_non_null(pools[p]);
+        alloc_pt alloc = mem_new_alloc(pools[p], POOL_SIZE);
+        assert_non_null(alloc);
+        memset(alloc->mem, 0x5A, POOL_SIZE);
+        assert_int_equal(mem_del_alloc(pools[p], alloc), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pools[p]), ALLOC_OK);
+    }
+
+    INFO("Opening one shard per NUMA node\n");
+    pool_shards_pt shards = mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, NULL);
+    assert_non_null(shards);
+    assert_true(shards->num_shards >= 1);
+    INFO("%u shard(s)\n", shards->num_shards);
+
+    pool_pt local = mem_pool_shard(shards);
+    assert_non_null(local);
+    unsigned found = 0;
+    for (unsigned n = 0; n < shards->num_shards; n++) {
+        if (shards->pools[n] == local) found = 1;
+    }
+    assert_true(found);
+
+    alloc_pt alloc = mem_new_alloc(local, 100);
+    assert_non_null(alloc);
+    assert_int_equal(mem_pool_close_sharded(shards), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(local, alloc), ALLOC_OK);
+    assert_int_equal(mem_pool_close_sharded(shards), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+/*******************************************/
+/***           11. COMPACTION            ***/
+/*******************************************/
+
+static void test_pool_compact(void **state) {
+    (void) state; /* unused */
+
+    const size_t block = 1000;
+    alloc_pt allocs[10];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(10 * block, FIRST_FIT);
+    assert_non_null(pool);
+
+    // nine movable blocks and a pinned one in the middle
+    for (unsigned u = 0; u < 10; u++) {
+        allocs[u] = (u == 5) ? mem_new_alloc(pool, block) : mem_new_handle(pool, block);
+        assert_non_null(allocs[u]);
+        memset(allocs[u]->mem, (int) u + 1, block);
+    }
+    for (unsigned u = 0; u < 10; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, 10 * block, 5 * block, 5, 5);
+    assert_null(mem_new_alloc(pool, 3 * block));
+
+    INFO("Compacting in steps of at most 1 us\n");
+    size_t moved = 0, step;
+    unsigned steps = 0;
+    while ((step = mem_pool_compact(pool, 1)) > 0) {
+        moved += step;
+        steps++;
+    }
+    INFO("%lu bytes moved in %u step(s)\n", (unsigned long) moved, steps);
+    assert_int_equal(moved, 4 * block);
+
+    // the gaps merge on either side of the pinned block
+    pool_segment_t exp[7] = {
+            {     block, 1 },
+            {     block, 1 },
+            { 3 * block, 0 },
+            {     block, 1 },
+            {     block, 1 },
+            {     block, 1 },
+            { 2 * block, 0 }
+    };
+    check_pool(pool, exp);
+    check_metadata(pool, FIRST_FIT, 10 * block, 5 * block, 5, 2);
+
+    // the handles followed their blocks, the pinned one didn't move
+    const unsigned order[5] = { 1, 3, 5, 7, 9 };
+    for (unsigned k = 0; k < 5; k++) {
+        const alloc_pt alloc = allocs[order[k]];
+        assert_true(alloc->mem == pool->mem + (k < 2 ? k : k + 3) * block);
+        assert_int_equal(alloc->mem[0], (char) (order[k] + 1));
+        assert_int_equal(alloc->mem[block - 1], (char) (order[k] + 1));
+    }
+    assert_int_equal(mem_pool_compact(pool, 0), 0);
+
+    alloc_pt large = mem_new_alloc(pool, 3 * block);
+    assert_non_null(large);
+    assert_true(large->mem == pool->mem + 2 * block);
+
+    assert_int_equal(mem_del_alloc(pool, large), ALLOC_OK);
+    for (unsigned k = 0; k < 5; k++) {
+        assert_int_equal(mem_del_alloc(pool, allocs[order[k]]), ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, 10 * block, 0, 0, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+/*******************************************/
+/***       12. MULTI-POOL ROUTING        ***/
+/*******************************************/
+
+static void test_pool_routing(void **state) {
+    (void) state; /* unused */
+
+    const size_t sizes[5] = { 1, 256, 257, 64 * 1024, 64 * 1024 + 1 };
+    const unsigned owners[5] = { 0, 0, 1, 1, 2 };
+    pool_pt pools[3];
+    alloc_pt allocs[5];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    for (unsigned p = 0; p < 3; p++) {
+        pools[p] = mem_pool_open(POOL_SIZE, FIRST_FIT);
+        assert_non_null(pools[p]);
+    }
+    assert_null(mem_new_alloc_routed(16)); // no size classes yet
+
+    // registered out of order, looked up smallest class first
+    assert_int_equal(mem_pool_route(pools[2], MEM_ROUTE_REST), ALLOC_OK);
+    assert_int_equal(mem_pool_route(pools[0], 256), ALLOC_OK);
+    assert_int_equal(mem_pool_route(pools[1], 64 * 1024), ALLOC_OK);
+    for (unsigned u = 0; u < 5; u++) {
+        allocs[u] = mem_new_alloc_routed(sizes[u]);
+        assert_non_null(allocs[u]);
+        assert_true(mem_find_alloc(pools[owners[u]], allocs[u]->mem) == allocs[u]);
+    }
+    assert_int_equal(pools[0]->num_allocs, 2);
+    assert_int_equal(pools[1]->num_allocs, 2);
+    assert_int_equal(pools[2]->num_allocs, 1);
+
+    // frees find their pool by address, whatever pool they came from
+    alloc_pt direct = mem_new_alloc(pools[2], 100);
+    assert_non_null(direct);
+    assert_int_equal(mem_del_alloc_routed(direct), ALLOC_OK);
+    for (unsigned u = 0; u < 5; u++) {
+        assert_int_equal(mem_del_alloc_routed(allocs[u]), ALLOC_OK);
+    }
+    for (unsigned p = 0; p < 3; p++) {
+        check_metadata(pools[p], FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    }
+
+    // a closed pool takes its size class along
+    assert_int_equal(mem_pool_close(pools[2]), ALLOC_OK);
+    assert_null(mem_new_alloc_routed(64 * 1024 + 1));
+    allocs[0] = mem_new_alloc_routed(64);
+    assert_non_null(allocs[0]);
+    assert_int_equal(mem_del_alloc_routed(allocs[0]), ALLOC_OK);
+
+    assert_int_equal(mem_pool_close(pools[0]), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pools[1]), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static void test_pool_of(void **state) {
+    (void) state; /* unused */
+
+    const unsigned num_pools = 200;
+    pool_pt *pools = (pool_pt *) calloc(num_pools, sizeof(pool_pt));
+    pool_options_t options = { .large_threshold = 8192 };
+    char local = 0;
+
+    assert_non_null(pools);
+    assert_int_equal(mem_init(), ALLOC_OK);
+    assert_null(mem_pool_of(&local));
+
+    // pools of all sizes, each pointer into one finds it
+    for (unsigned p = 0; p < num_pools; p++) {
+        pools[p] = mem_pool_open_opts(4096 * (1 + p % 7) * (p % 3 ? 1 : 600), FIRST_FIT, &options);
+        assert_non_null(pools[p]);
+    }
+    for (unsigned p = 0; p < num_pools; p++) {
+        assert_true(mem_pool_of(pools[p]->mem) == pools[p]);
+        assert_true(mem_pool_of(pools[p]->mem + pools[p]->total_size / 2) == pools[p]);
+        assert_true(mem_pool_of(pools[p]->mem + pools[p]->total_size - 1) == pools[p]);
+    }
+    assert_null(mem_pool_of(&local));
+    assert_null(mem_pool_of(NULL));
+
+    // a large allocation is mapped apart, and still belongs to its pool
+    alloc_pt large = mem_new_alloc(pools[1], 100000);
+    assert_non_null(large);
+    assert_true(mem_pool_of(large->mem + 99999) == pools[1]);
+    char *gone = large->mem;
+    assert_int_equal(mem_del_alloc_routed(large), ALLOC_OK);
+    assert_true(mem_pool_of(gone) != pools[1]);
+
+    // closed pools are forgotten, their neighbours are not
+    for (unsigned p = 0; p < num_pools; p += 2) {
+        char *mem = pools[p]->mem;
+        assert_int_equal(mem_pool_close(pools[p]), ALLOC_OK);
+        assert_true(mem_pool_of(mem) == NULL);
+    }
+    for (unsigned p = 1; p < num_pools; p += 2) {
+        assert_true(mem_pool_of(pools[p]->mem) == pools[p]);
+        assert_int_equal(mem_pool_close(pools[p]), ALLOC_OK);
+    }
+
+    free(pools);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_sub(void **state) {
+    (void) state; /* unused */
+
+    const unsigned num_sessions = 2000;
+    pool_segment_pt segs = NULL;
+    unsigned num_segments = 0;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt parent = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(parent);
+    alloc_pt before = mem_new_alloc(parent, 100);
+    assert_non_null(before);
+
+    // the sub-pool is one allocation of its parent
+    pool_pt sub = mem_pool_open_sub(parent, 10000, BEST_FIT);
+    assert_non_null(sub);
+    assert_true(sub->mem == parent->mem + 100);
+    assert_int_equal(sub->total_size, 10000);
+    assert_int_equal(sub->policy, BEST_FIT);
+    check_metadata(parent, FIRST_FIT, POOL_SIZE, 10100, 2, 1);
+    check_metadata(sub, BEST_FIT, 10000, 0, 0, 1);
+
+    // a pool of its own, down to nesting and owner lookup
+    alloc_pt inner = mem_new_alloc(sub, 300);
+    assert_non_null(inner);
+    assert_true(inner->mem == sub->mem);
+    pool_pt nested = mem_pool_open_sub(sub, 1000, FIRST_FIT);
+    assert_non_null(nested);
+    alloc_pt innermost = mem_new_alloc(nested, 10);
+    assert_non_null(innermost);
+    assert_true(mem_pool_of(before->mem) == parent);
+    assert_true(mem_pool_of(inner->mem + 299) == sub);
+    assert_true(mem_pool_of(sub->mem + 9999) == sub);
+    assert_true(mem_pool_of(innermost->mem) == nested);
+    assert_true(mem_pool_of(sub->mem + 10000) == parent);
+    check_metadata(sub, BEST_FIT, 10000, 1300, 2, 1);
+
+    // a parent outlives its sub-pools, which close like any pool
+    assert_int_equal(mem_pool_close(parent), ALLOC_NOT_FREED);
+    assert_int_equal(mem_pool_close(sub), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc_routed(innermost), ALLOC_OK);
+    assert_int_equal(mem_pool_close(nested), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(sub, inner), ALLOC_OK);
+    assert_int_equal(mem_pool_close(sub), ALLOC_OK);
+    check_metadata(parent, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+
+    // short-lived per-session pools keep coming back to the same region
+    for (unsigned s = 0; s < num_sessions; s++) {
+        sub = mem_pool_open_sub(parent, 4096, FIRST_FIT);
+        assert_non_null(sub);
+        assert_true(sub->mem == parent->mem + 100);
+        assert_non_null(mem_new_alloc(sub, 64 + s % 100));
+        assert_int_equal(mem_del_alloc(sub, mem_find_alloc(sub, sub->mem)), ALLOC_OK);
+        assert_int_equal(mem_pool_close(sub), ALLOC_OK);
+    }
+    mem_inspect_pool(parent, &segs, &num_segments);
+    assert_int_equal(num_segments, 2);
+    free(segs);
+
+    assert_int_equal(mem_del_alloc(parent, before), ALLOC_OK);
+    assert_int_equal(mem_pool_close(parent), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+/*******************************************/
+/***        13. DRIVER ROUTINE           ***/
 /*******************************************/
 
 int run_test_suite() {
+    // a failed scenario leaves its pool open and the pool store initialized,
+    // failing every test after it in the group, so these go in their own
+    const struct CMUnitTest feature_tests[] = {
+            cmocka_unit_test_setup_teardown(test_cache_reuse, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_cache_large_slabs),
+
+            cmocka_unit_test(test_pool_release_rss),
+            cmocka_unit_test(test_pool_huge_pages),
+            cmocka_unit_test(test_pool_growable),
+            cmocka_unit_test(test_pool_prefault),
+            cmocka_unit_test(test_pool_trim),
+            cmocka_unit_test(test_pool_scavenger),
+
+            cmocka_unit_test(test_pool_file_reopen),
+
+            cmocka_unit_test(test_shared_pool_handoff),
+            cmocka_unit_test(test_shared_pool_node_table_full),
+
+            cmocka_unit_test(test_pool_numa),
+
+            cmocka_unit_test(test_pool_compact),
+
+            cmocka_unit_test(test_pool_routing),
+            cmocka_unit_test(test_pool_of),
+            cmocka_unit_test(test_pool_sub),
+    };
+
     const struct CMUnitTest tests[] = {
             cmocka_unit_test(test_pool_store_smoketest),
             cmocka_unit_test(test_pool_smoketest),
 
             cmocka_unit_test(test_pool_nonempty),
+            cmocka_unit_test(test_pool_stable_handles),
 
             cmocka_unit_test_setup_teardown(test_pool_ff_metadata, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_bf_metadata, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test(test_pool_stats),
+            cmocka_unit_test(test_pool_quick_bins),
+            cmocka_unit_test(test_pool_small_objects),
+            cmocka_unit_test(test_pool_scalar_scan),
+            cmocka_unit_test(test_pool_node_reuse),
+            cmocka_unit_test(test_pool_large_allocs),
+            cmocka_unit_test(test_pool_auto_fit),
 
             cmocka_unit_test_setup_teardown(test_pool_scenario00, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario01, pool_ff_setup, pool_ff_teardown),
@@ -2447,7 +3879,8 @@ int run_test_suite() {
 //            cmocka_unit_test(test_pool_stresstest),
     };
 
-    return cmocka_run_group_tests_name("pool_test_suite", tests, NULL, NULL);
+    const int failed = cmocka_run_group_tests_name("pool_feature_suite", feature_tests, NULL, NULL);
+    return failed + cmocka_run_group_tests_name("pool_test_suite", tests, NULL, NULL);
 }
 
 /* future editions */